@@ -1,8 +1,10 @@
-# hides all symbols of a library
+# hides all symbols of a library, except for the class table (see CLASS_LOADER_BEGIN_CLASS_TABLE)
 function(class_loader_hide_library_symbols target)
   set(version_script "${CMAKE_CURRENT_BINARY_DIR}/class_loader_hide_library_symbols__${target}.script")
   file(WRITE "${version_script}"
     "    {
+      global:
+        class_loader_class_table;
       local:
         *;
     };"
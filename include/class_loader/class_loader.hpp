@@ -32,24 +32,39 @@
 #ifndef CLASS_LOADER__CLASS_LOADER_HPP_
 #define CLASS_LOADER__CLASS_LOADER_HPP_
 
-#include <boost/bind.hpp>
+#include <boost/align/aligned_alloc.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
-#include <functional>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "console_bridge/console.h"
 
 #include "class_loader/class_loader_core.hpp"
+#include "class_loader/logging.hpp"
 #include "class_loader/register_macro.hpp"
 #include "class_loader/visibility_control.hpp"
 
 namespace class_loader
 {
 
+class MultiLibraryClassLoader;
+
+namespace impl
+{
+class IdleUnloadReaper;
+}  // namespace impl
+
 /**
  * @brief Returns the default library prefix for the native os
  */
@@ -71,26 +86,246 @@ std::string systemLibrarySuffix();
 CLASS_LOADER_PUBLIC
 std::string systemLibraryFormat(const std::string & library_name);
 
+/**
+ * @brief Flags controlling how the runtime library of a ClassLoader is opened
+ */
+enum LibraryLoadFlags
+{
+  /// Symbols of the library are made available to libraries opened later (i.e. RTLD_GLOBAL)
+  LIBRARY_LOAD_DEFAULT = 0,
+  /**
+   * Symbols of the library are kept local to it (i.e. RTLD_LOCAL), which saves symbol
+   * interposition when the library is opened and lets it really be unmapped when closed.
+   * Only use this for libraries that contain nothing but plugins.
+   */
+  LIBRARY_LOAD_LOCAL = 1 << 0,
+  /**
+   * When the library is read into the page cache ahead of opening it (@see ClassLoader::prefetch()
+   * and MultiLibraryClassLoader::loadLibraries()), the libraries it depends on are read as well.
+   * Meant for libraries on slow storage whose dependencies are not loaded in the process yet.
+   */
+  LIBRARY_PREFETCH_DEPENDENCIES = 1 << 1
+};
+
 /**
  * @class ClassLoader
  * @brief This class allows loading and unloading of dynamically linked libraries which contain class definitions from which objects can be created/destroyed during runtime (i.e. class_loader). Libraries loaded by a ClassLoader are only accessible within scope of that ClassLoader object.
  */
 class ClassLoader
 {
+  struct InstancePool;
+
 public:
+  /**
+   * @class Deleter
+   * @brief The deleter of managed instances, hands the object back to the ClassLoader that created it.
+   *
+   * Unlike a type-erased std::function it holds a single pointer and never allocates, so managed
+   * instances are cheap to create, move and store.
+   */
+  template<class Base>
+  class Deleter
+  {
+  public:
+    Deleter()
+    : pool_(nullptr)
+    {}
+
+    /**
+     * @param loader - The ClassLoader that created the objects
+     */
+    explicit Deleter(ClassLoader * loader)
+    : pool_(nullptr != loader ? &loader->unpooled_instances_ : nullptr)
+    {}
+
+    void operator()(Base * obj) const
+    {
+      if (nullptr == pool_) {
+        return;
+      }
+      if (nullptr != pool_->meta_object) {
+        pool_->loader->onPooledPluginDeletion<Base>(*pool_, obj);
+      } else {
+        pool_->loader->onPluginDeletion<Base>(obj);
+      }
+    }
+
+  private:
+    friend class ClassLoader;
+
+    /**
+     * @param pool - The pool of the factory of objects created by createPooledInstance()
+     */
+    explicit Deleter(InstancePool * pool)
+    : pool_(pool)
+    {}
+
+    InstancePool * pool_;
+  };
+
   template<typename Base>
-  using DeleterType = std::function<void(Base *)>;
+  using DeleterType = Deleter<Base>;
 
   template<typename Base>
   using UniquePtr = std::unique_ptr<Base, DeleterType<Base>>;
 
+  /**
+   * @class PlacementDeleter
+   * @brief The deleter of instances created in storage provided by the caller, destroys the object without releasing its storage.
+   */
+  template<class Base>
+  class PlacementDeleter
+  {
+  public:
+    PlacementDeleter()
+    : loader_(nullptr), meta_object_(nullptr)
+    {}
+
+    /**
+     * @param loader - The ClassLoader that created the objects
+     * @param meta_object - The factory that created the objects
+     */
+    PlacementDeleter(ClassLoader * loader, impl::AbstractMetaObject<Base> * meta_object)
+    : loader_(loader), meta_object_(meta_object)
+    {}
+
+    void operator()(Base * obj) const
+    {
+      if (nullptr != loader_) {
+        loader_->onPlacedPluginDeletion<Base>(meta_object_, obj);
+      }
+    }
+
+  private:
+    ClassLoader * loader_;
+    impl::AbstractMetaObject<Base> * meta_object_;
+  };
+
+  /**
+   * @brief A managed instance created in storage provided by the caller (@see createInstanceAt())
+   *
+   * The storage must outlive the instance.
+   */
+  template<typename Base>
+  using PlacedPtr = std::unique_ptr<Base, PlacementDeleter<Base>>;
+
+  /**
+   * @class Factory
+   * @brief A lightweight handle bound to the factory of a single plugin class (@see getFactory()).
+   *
+   * Creating instances through a Factory does not look up the class in the global plugin
+   * registry. The handle is invalidated when the library is unloaded from its ClassLoader, after
+   * which create() throws a CreateClassException and getFactory() must be called again.
+   * A Factory must not outlive the ClassLoader that created it.
+   */
+  template<class Base>
+  class Factory
+  {
+  public:
+    Factory()
+    : loader_(nullptr), meta_object_(nullptr), library_generation_(0)
+    {}
+
+    /**
+     * @brief Gets the name of the class this handle creates
+     */
+    const std::string & getClassName() const {return class_name_;}
+
+    /**
+     * @brief Indicates if the handle can still be used to create instances
+     * @return true if the library the factory belongs to has not been unloaded since the handle was created, otherwise false
+     */
+    bool isValid() const
+    {
+      if (nullptr == loader_) {
+        return false;
+      }
+      return library_generation_ == loader_->library_generation_.load();
+    }
+
+    /**
+     * @brief  Generates an instance of the class this handle is bound to.
+     * @return A std::unique_ptr<Base> to newly created plugin object
+     */
+    UniquePtr<Base> create() const
+    {
+      if (nullptr == loader_) {
+        throw class_loader::CreateClassException(
+                "Could not create instance from an empty factory handle");
+      }
+      Base * raw = loader_->createRawInstanceFromFactory<Base>(
+        class_name_, meta_object_, library_generation_, nullptr, 0);
+      return UniquePtr<Base>(raw, DeleterType<Base>(loader_));
+    }
+
+    /**
+     * @brief Gets the size of the storage an instance of the class needs (@see createAt())
+     * @note Like the alignment, it may only be queried while the handle isValid()
+     */
+    std::size_t objectSize() const
+    {
+      return nullptr != meta_object_ ? meta_object_->objectSize() : 0;
+    }
+
+    /**
+     * @brief Gets the alignment of the storage an instance of the class needs (@see createAt())
+     */
+    std::size_t objectAlignment() const
+    {
+      return nullptr != meta_object_ ? meta_object_->objectAlignment() : 1;
+    }
+
+    /**
+     * @brief  Generates an instance of the class this handle is bound to in storage provided by the caller.
+     *
+     * Nothing is allocated, so instances can be created from preallocated arenas. The instance
+     * keeps the library loaded like any other managed instance.
+     *
+     * @param  storage At least objectSize() bytes aligned to objectAlignment(), which must outlive the instance
+     * @param  size The size of storage in bytes
+     * @return A PlacedPtr<Base> to the newly created plugin object
+     */
+    PlacedPtr<Base> createAt(void * storage, std::size_t size) const
+    {
+      if (nullptr == loader_) {
+        throw class_loader::CreateClassException(
+                "Could not create instance from an empty factory handle");
+      }
+      if (nullptr == storage) {
+        throw class_loader::CreateClassException(
+                "Could not create instance of type " + class_name_ + " without storage");
+      }
+      Base * raw = loader_->createRawInstanceFromFactory<Base>(
+        class_name_, meta_object_, library_generation_, storage, size);
+      return PlacedPtr<Base>(raw, PlacementDeleter<Base>(loader_, meta_object_));
+    }
+
+  private:
+    friend class ClassLoader;
+
+    Factory(
+      ClassLoader * loader, impl::AbstractMetaObject<Base> * meta_object,
+      const std::string & class_name, unsigned int library_generation)
+    : loader_(loader), meta_object_(meta_object), class_name_(class_name),
+      library_generation_(library_generation)
+    {}
+
+    ClassLoader * loader_;
+    impl::AbstractMetaObject<Base> * meta_object_;
+    std::string class_name_;
+    unsigned int library_generation_;
+  };
+
   /**
    * @brief  Constructor for ClassLoader
    * @param library_path - The path of the runtime library to load
    * @param ondemand_load_unload - Indicates if on-demand (lazy) unloading/loading of libraries occurs as plugins are created/destroyed
+   * @param load_flags - A combination of LibraryLoadFlags. They only take effect if the library is not already opened by another ClassLoader.
    */
   CLASS_LOADER_PUBLIC
-  explicit ClassLoader(const std::string & library_path, bool ondemand_load_unload = false);
+  explicit ClassLoader(
+    const std::string & library_path, bool ondemand_load_unload = false,
+    unsigned int load_flags = LIBRARY_LOAD_DEFAULT);
 
   /**
    * @brief  Destructor for ClassLoader. All libraries opened by this ClassLoader are unloaded automatically.
@@ -105,15 +340,39 @@ public:
   template<class Base>
   std::vector<std::string> getAvailableClasses()
   {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->getAvailableClasses<Base>();
+    }
     return class_loader::impl::getAvailableClasses<Base>(this);
   }
 
+  /**
+   * @brief  Visits the classes that can be loaded by this object without allocating their names
+   * Unlike getAvailableClasses() the classes are not sorted. The callback runs without the
+   * registry locked, so it may use this or any other ClassLoader.
+   * @param  callback Invoked with the const std::string & name of each class derived from <Base>
+   */
+  template<class Base, typename Callback>
+  void forEachAvailableClass(Callback && callback)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->forEachAvailableClass<Base>(std::forward<Callback>(callback));
+    }
+    class_loader::impl::forEachAvailableClass<Base>(this, std::forward<Callback>(callback));
+  }
+
   /**
    * @brief Gets the full-qualified path and name of the library associated with this class loader
    */
   CLASS_LOADER_PUBLIC
   std::string getLibraryPath() {return library_path_;}
 
+  /**
+   * @brief Gets the LibraryLoadFlags the library is opened with
+   */
+  CLASS_LOADER_PUBLIC
+  unsigned int getLoadFlags() const {return load_flags_;}
+
   /**
    * @brief  Generates an instance of loadable classes (i.e. class_loader).
    *
@@ -126,9 +385,11 @@ public:
   template<class Base>
   std::shared_ptr<Base> createSharedInstance(const std::string & derived_class_name)
   {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createSharedInstance<Base>(derived_class_name);
+    }
     return std::shared_ptr<Base>(
-      createRawInstance<Base>(derived_class_name, true),
-      boost::bind(&ClassLoader::onPluginDeletion<Base>, this, _1));
+      createRawInstance<Base>(derived_class_name, true), DeleterType<Base>(this));
   }
 
   /**
@@ -139,9 +400,11 @@ public:
   template<class Base>
   boost::shared_ptr<Base> createInstance(const std::string & derived_class_name)
   {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createInstance<Base>(derived_class_name);
+    }
     return boost::shared_ptr<Base>(
-      createRawInstance<Base>(derived_class_name, true),
-      boost::bind(&ClassLoader::onPluginDeletion<Base>, this, _1));
+      createRawInstance<Base>(derived_class_name, true), DeleterType<Base>(this));
   }
 
   /**
@@ -159,10 +422,214 @@ public:
   template<class Base>
   UniquePtr<Base> createUniqueInstance(const std::string & derived_class_name)
   {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createUniqueInstance<Base>(derived_class_name);
+    }
     Base * raw = createRawInstance<Base>(derived_class_name, true);
-    return std::unique_ptr<Base, DeleterType<Base>>(
-      raw,
-      boost::bind(&ClassLoader::onPluginDeletion<Base>, this, _1));
+    return UniquePtr<Base>(raw, DeleterType<Base>(this));
+  }
+
+  /**
+   * @brief  Generates an instance of a loadable class registered with CLASS_LOADER_REGISTER_CLASS_WITH_ARGS.
+   *
+   * Same as createUniqueInstance() except that the arguments are forwarded to the constructor of
+   * the class. The factory is looked up by the decayed types of the arguments, which must match
+   * the types the class was registered with.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  args The constructor arguments
+   * @return A std::unique_ptr<Base> to newly created plugin object
+   */
+  template<class Base, class ... Args>
+  UniquePtr<Base> createUniqueInstance(const std::string & derived_class_name, Args && ... args)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createUniqueInstance<Base>(derived_class_name, std::forward<Args>(args) ...);
+    }
+    Base * raw =
+      createRawInstanceWithArgs<Base>(derived_class_name, std::forward<Args>(args) ...);
+    return UniquePtr<Base>(raw, DeleterType<Base>(this));
+  }
+
+  /**
+   * @brief  Generates an instance of a loadable class registered with CLASS_LOADER_REGISTER_CLASS_WITH_ARGS.
+   *
+   * Same as the createUniqueInstance() overload with constructor arguments except it returns a std::shared_ptr.
+   */
+  template<class Base, class ... Args>
+  std::shared_ptr<Base> createSharedInstance(
+    const std::string & derived_class_name, Args && ... args)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createSharedInstance<Base>(derived_class_name, std::forward<Args>(args) ...);
+    }
+    return std::shared_ptr<Base>(
+      createRawInstanceWithArgs<Base>(derived_class_name, std::forward<Args>(args) ...),
+      DeleterType<Base>(this));
+  }
+
+  /**
+   * @brief  Generates an instance of loadable classes (i.e. class_loader) in storage recycled from previously destroyed instances.
+   *
+   * Same as createUniqueInstance() except that the memory of destroyed instances is kept in a
+   * pool of this ClassLoader, per class, and reused by the next pooled instance of the same
+   * class rather than returned to the heap. The pool grows to the largest number of pooled
+   * instances alive at the same time and is drained when the library is unloaded.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @return A std::unique_ptr<Base> to newly created plugin object
+   */
+  template<class Base>
+  UniquePtr<Base> createPooledInstance(const std::string & derived_class_name)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createPooledInstance<Base>(derived_class_name);
+    }
+    // The reference also keeps the pools from being drained while we use them
+    acquireLoadedLibrary(1);
+    InstancePool * pool = nullptr;
+    void * storage = nullptr;
+    Base * obj = nullptr;
+    try {
+      impl::AbstractMetaObject<Base> * meta_object =
+        class_loader::impl::getMetaObjectForClass<Base>(derived_class_name, this);
+      if (nullptr == meta_object) {
+        throw class_loader::CreateClassException(
+                "Could not create instance of type " + derived_class_name);
+      }
+      pool = &getInstancePool(meta_object);
+      storage = pool->takeStorage();
+      if (nullptr == storage) {
+        storage = boost::alignment::aligned_alloc(
+          meta_object->objectAlignment(), meta_object->objectSize());
+      }
+      if (nullptr == storage) {
+        throw std::bad_alloc();
+      }
+      obj = impl::createAndRecordInstance<Base>(
+        meta_object, [meta_object, storage]() {return meta_object->createAt(storage);});
+    } catch (...) {
+      if (nullptr != storage) {
+        pool->returnStorage(storage);
+      }
+      releasePluginReference();
+      throw;
+    }
+    return UniquePtr<Base>(obj, DeleterType<Base>(pool));
+  }
+
+  /**
+   * @brief  Generates an instance of loadable classes (i.e. class_loader) in storage provided by the caller.
+   *
+   * Same as createUniqueInstance() except that the object is constructed in place and its
+   * storage is not released when it is destroyed. The size and alignment the storage needs are
+   * available from getFactory(), whose handle also creates instances in place without looking
+   * up the class again.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  storage Storage for the object, which must outlive it
+   * @param  size The size of storage in bytes
+   * @return A PlacedPtr<Base> to the newly created plugin object
+   */
+  template<class Base>
+  PlacedPtr<Base> createInstanceAt(
+    const std::string & derived_class_name, void * storage, std::size_t size)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createInstanceAt<Base>(derived_class_name, storage, size);
+    }
+    acquireLoadedLibrary(1);
+    impl::AbstractMetaObject<Base> * meta_object = nullptr;
+    Base * obj = nullptr;
+    try {
+      meta_object = class_loader::impl::getMetaObjectForClass<Base>(derived_class_name, this);
+      if (nullptr == meta_object) {
+        throw class_loader::CreateClassException(
+                "Could not create instance of type " + derived_class_name);
+      }
+      checkPlacementStorage<Base>(derived_class_name, meta_object, storage, size);
+      obj = impl::createAndRecordInstance<Base>(
+        meta_object, [meta_object, storage]() {return meta_object->createAt(storage);});
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
+    return PlacedPtr<Base>(obj, PlacementDeleter<Base>(this, meta_object));
+  }
+
+  /**
+   * @brief  Generates several instances of the same loadable class (i.e. class_loader).
+   *
+   * Same as calling createUniqueInstance() count times, except that the class is only looked up
+   * once and the instances are accounted for at once.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  count The number of instances to create
+   * @return A vector of count std::unique_ptr<Base> to newly created plugin objects
+   */
+  template<class Base>
+  std::vector<UniquePtr<Base>> createInstances(
+    const std::string & derived_class_name, std::size_t count)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createInstances<Base>(derived_class_name, count);
+    }
+    std::vector<UniquePtr<Base>> instances;
+    if (0 == count) {
+      return instances;
+    }
+    acquireLoadedLibrary(static_cast<int>(count));
+    try {
+      impl::AbstractMetaObject<Base> * meta_object =
+        class_loader::impl::getMetaObjectForClass<Base>(derived_class_name, this);
+      if (nullptr == meta_object) {
+        throw class_loader::CreateClassException(
+                "Could not create instance of type " + derived_class_name);
+      }
+      instances.reserve(count);
+      while (instances.size() < count) {
+        Base * obj = impl::createAndRecordInstance<Base>(
+          meta_object, [meta_object]() {return meta_object->create();});
+        instances.push_back(UniquePtr<Base>(obj, DeleterType<Base>(this)));
+      }
+    } catch (...) {
+      // The instances created so far give their references back when destroyed
+      releasePluginReferences(static_cast<int>(count - instances.size()));
+      throw;
+    }
+    return instances;
+  }
+
+  /**
+   * @brief  Gets a handle to the factory of a loadable class, which can create instances without looking up the class again.
+   *
+   * It is not necessary for the user to call loadLibrary() as it will be invoked automatically
+   * if the library is not yet loaded (which typically happens when in "On Demand Load/Unload" mode).
+   * Note that in "On Demand Load/Unload" mode the library is unloaded, and thus the handle
+   * invalidated, as soon as the last instance created by this ClassLoader is destroyed.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @return A Factory<Base> bound to the class
+   */
+  template<class Base>
+  Factory<Base> getFactory(const std::string & derived_class_name)
+  {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->getFactory<Base>(derived_class_name);
+    }
+    ensureLibraryLoaded();
+
+    // Note: The generation is read before looking up the factory, so a concurrent unload in
+    // between leaves us with an already invalid handle rather than a dangling one.
+    unsigned int library_generation = library_generation_;
+
+    impl::AbstractMetaObject<Base> * meta_object =
+      class_loader::impl::getMetaObjectForClass<Base>(derived_class_name, this);
+    if (nullptr == meta_object) {
+      throw class_loader::CreateClassException(
+              "Could not find factory for class type " + derived_class_name);
+    }
+    return Factory<Base>(this, meta_object, derived_class_name, library_generation);
   }
 
   /**
@@ -180,6 +647,9 @@ public:
   template<class Base>
   Base * createUnmanagedInstance(const std::string & derived_class_name)
   {
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->createUnmanagedInstance<Base>(derived_class_name);
+    }
     return createRawInstance<Base>(derived_class_name, false);
   }
 
@@ -192,9 +662,10 @@ public:
   template<class Base>
   bool isClassAvailable(const std::string & class_name)
   {
-    std::vector<std::string> available_classes = getAvailableClasses<Base>();
-    return std::find(
-      available_classes.begin(), available_classes.end(), class_name) != available_classes.end();
+    if (ClassLoader * version = getReloadedVersion()) {
+      return version->isClassAvailable<Base>(class_name);
+    }
+    return class_loader::impl::isClassAvailable<Base>(class_name, this);
   }
 
   /**
@@ -218,6 +689,45 @@ public:
   CLASS_LOADER_PUBLIC
   bool isOnDemandLoadUnloadEnabled() {return ondemand_load_unload_;}
 
+  /**
+  * @brief Getter for if an unmanaged (i.e. unsafe) instance has been created flag
+  */
+  CLASS_LOADER_PUBLIC
+  static bool hasUnmanagedInstanceBeenCreated();
+
+  /**
+   * @brief Gets the number of managed plugin instances created by this ClassLoader which have not been destroyed yet
+   */
+  CLASS_LOADER_PUBLIC
+  int getInstanceCount();
+
+  /**
+   * @brief  Sets how long the library is kept loaded in "On Demand Load/Unload" mode after the last plugin has been destroyed.
+   *
+   * With a delay of zero (the default) the library is unloaded right away by the thread
+   * destroying the last plugin. Otherwise it is unloaded by a background reaper once it has
+   * been idle for the delay, and creating a plugin in the meantime reuses the loaded library.
+   * The reaper also unloads idle libraries early, least recently used first, when more than
+   * setMaxIdleLibraries() of them are waiting.
+   *
+   * @param delay - The time an unused library stays loaded
+   */
+  CLASS_LOADER_PUBLIC
+  void setUnloadDelay(std::chrono::milliseconds delay);
+
+  /**
+   * @brief Gets the time an unused library stays loaded in "On Demand Load/Unload" mode (@see setUnloadDelay())
+   */
+  CLASS_LOADER_PUBLIC
+  std::chrono::milliseconds getUnloadDelay();
+
+  /**
+   * @brief  Limits the number of idle libraries kept loaded by the ClassLoaders of this process (@see setUnloadDelay())
+   * @param max_idle_libraries - The number of idle libraries above which the least recently used ones are unloaded, unlimited by default
+   */
+  CLASS_LOADER_PUBLIC
+  static void setMaxIdleLibraries(std::size_t max_idle_libraries);
+
   /**
    * @brief  Attempts to load a library on behalf of the ClassLoader. If the library is already opened, this method has no effect. If the library has been already opened by some other entity (i.e. another ClassLoader or global interface), this object is given permissions to access any plugin classes loaded by that other entity. This is
    * @param  library_path The path to the library to load
@@ -225,6 +735,26 @@ public:
   CLASS_LOADER_PUBLIC
   void loadLibrary();
 
+  /**
+   * @brief  Loads the library on a background thread, reading the library file into the page cache first.
+   *
+   * This takes the cost of opening a library in "On Demand Load/Unload" mode off the thread that
+   * creates the first instance. Creating an instance while the prefetch is running waits for it
+   * to complete instead of loading the library again. The load is accounted for as the one a
+   * first createInstance() would have made, i.e. in on-demand mode the library is unloaded again
+   * once the last instance is destroyed. If the library is already loaded this has no effect.
+   *
+   * @return A future that becomes ready once the library is loaded and that rethrows load errors
+   */
+  CLASS_LOADER_PUBLIC
+  std::shared_future<void> prefetch();
+
+  /**
+   * @brief  Blocks until a load started by prefetch() has completed. Load errors are not reported here, but when the library is used.
+   */
+  CLASS_LOADER_PUBLIC
+  void waitForPrefetch();
+
   /**
    * @brief  Attempts to unload a library loaded within scope of the ClassLoader. If the library is not opened, this method has no effect. If the library is opened by other another ClassLoader, the library will NOT be unloaded internally -- however this ClassLoader will no longer be able to instantiate class_loader bound to that library. If there are plugin objects that exist in memory created by this classloader, a warning message will appear and the library will not be unloaded. If loadLibrary() was called multiple times (e.g. in the case of multiple threads or purposefully in a single thread), the user is responsible for calling unloadLibrary() the same number of times. The library will not be unloaded within the context of this classloader until the number of unload calls matches the number of loads.
    * @return The number of times more unloadLibrary() has to be called for it to be unbound from this ClassLoader
@@ -232,7 +762,81 @@ public:
   CLASS_LOADER_PUBLIC
   int unloadLibrary();
 
+  /**
+   * @brief  Loads the library file as it is now next to the version in use, and creates all further instances from it.
+   *
+   * The file the library was loaded from is copied into a private temporary directory and
+   * opened from there; the copy is unlinked as soon as it is mapped. Its factories shadow those
+   * of the version in use for this ClassLoader only, other ClassLoaders bound to the same library
+   * keep using the version they loaded. Instances that already exist are not affected, their
+   * version is unloaded when the last of them is destroyed (@see migrateInstance()). All other
+   * methods of this ClassLoader refer to the newest version.
+   *
+   * Only reload libraries that contain nothing but plugins and whose symbols are not interposed
+   * by an earlier version, i.e. that are opened with LIBRARY_LOAD_LOCAL or hide their symbols.
+   * The default LIBRARY_LOAD_DEFAULT binds symbols globally (RTLD_GLOBAL), so the exported
+   * symbols of the copy may then still resolve to the earlier version. The reload fails in that
+   * case rather than creating instances of the earlier version. Instances created while the
+   * library is being reloaded may come from either version.
+   *
+   * @throws class_loader::LibraryLoadException if the new version cannot be loaded or its factories resolve to an earlier version, the version in use is kept then
+   */
+  CLASS_LOADER_PUBLIC
+  void reloadLibrary();
+
+  /**
+   * @brief  Replaces an instance by a new one created from the newest version of the library (@see reloadLibrary()).
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  instance The instance to replace, destroyed once its state has been transferred
+   * @param  transfer A callable taking (Base & from, Base & to) that moves the state of the old instance to the new one
+   * @return A std::unique_ptr<Base> to the new plugin object
+   */
+  template<class Base, typename Transfer>
+  UniquePtr<Base> migrateInstance(
+    const std::string & derived_class_name, UniquePtr<Base> instance, Transfer transfer)
+  {
+    UniquePtr<Base> migrated = createUniqueInstance<Base>(derived_class_name);
+    if (instance) {
+      transfer(*instance, *migrated);
+    }
+    return migrated;
+  }
+
 private:
+  friend class impl::IdleUnloadReaper;
+  friend class MultiLibraryClassLoader;
+
+  /**
+   * @brief Gets the ClassLoader of the newest version of the library, nullptr if it has never been reloaded
+   */
+  ClassLoader * getReloadedVersion() const {return reloaded_version_.load();}
+
+  /**
+   * @brief Unloads the library once no instance created from it is left, as a newer version has been loaded
+   */
+  CLASS_LOADER_PUBLIC
+  void retireLibrary();
+
+  /**
+   * @brief Unloads the library of a retired version for good, unless it has plugins again
+   * @note The caller must not hold plugin_ref_count_mutex_ without load_ref_count_mutex_
+   */
+  CLASS_LOADER_PUBLIC
+  void unloadRetiredLibrary();
+
+  /**
+   * @brief Implementation of loadLibrary() for the library of this ClassLoader, whatever the version in use
+   */
+  CLASS_LOADER_PUBLIC
+  void loadLibraryInternal();
+
+  /**
+   * @brief Implementation of waitForPrefetch() for the library of this ClassLoader, whatever the version in use
+   */
+  CLASS_LOADER_PUBLIC
+  void waitForPrefetchInternal();
+
   /**
    * @brief Callback method when a plugin created by this class loader is destroyed
    * @param obj - A pointer to the deleted object
@@ -240,30 +844,164 @@ private:
   template<class Base>
   void onPluginDeletion(Base * obj)
   {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader::ClassLoader: Calling onPluginDeletion() for obj ptr = %p.\n",
       reinterpret_cast<void *>(obj));
     if (nullptr == obj) {
       return;
     }
-    boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+    if (impl::isStatisticsEnabled()) {
+      impl::recordInstanceDestroyed(typeid(*obj));
+    }
+    // The reference held by obj keeps the library loaded while it is destroyed
     delete (obj);
-    plugin_ref_count_ = plugin_ref_count_ - 1;
-    assert(plugin_ref_count_ >= 0);
-    if (0 == plugin_ref_count_ && isOnDemandLoadUnloadEnabled()) {
-      if (!ClassLoader::hasUnmanagedInstanceBeenCreated()) {
-        unloadLibraryInternal(false);
-      } else {
-        CONSOLE_BRIDGE_logWarn(
-          "class_loader::ClassLoader: "
-          "Cannot unload library %s even though last shared pointer went out of scope. "
-          "This is because createUnmanagedInstance was used within the scope of this process,"
-          " perhaps by a different ClassLoader. Library will NOT be closed.",
-          getLibraryPath().c_str());
-      }
+    releasePluginReference();
+  }
+
+  /**
+   * @brief Callback method when a plugin created by createPooledInstance() is destroyed
+   * @param pool - The pool of the factory that created the object
+   * @param obj - A pointer to the deleted object
+   */
+  template<class Base>
+  void onPooledPluginDeletion(InstancePool & pool, Base * obj)
+  {
+    CLASS_LOADER_LOG_DEBUG(
+      "class_loader::ClassLoader: Calling onPooledPluginDeletion() for obj ptr = %p.\n",
+      reinterpret_cast<void *>(obj));
+    if (nullptr == obj) {
+      return;
     }
+    if (impl::isStatisticsEnabled()) {
+      impl::recordInstanceDestroyed(typeid(*obj));
+    }
+    const impl::AbstractMetaObject<Base> * meta_object =
+      static_cast<const impl::AbstractMetaObject<Base> *>(pool.meta_object);
+    pool.returnStorage(meta_object->destroyAt(obj));
+    releasePluginReference();
+  }
+
+  /**
+   * @brief Callback method when a plugin created in storage provided by the caller is destroyed
+   * @param meta_object - The factory that created the object
+   * @param obj - A pointer to the destroyed object
+   */
+  template<class Base>
+  void onPlacedPluginDeletion(impl::AbstractMetaObject<Base> * meta_object, Base * obj)
+  {
+    CLASS_LOADER_LOG_DEBUG(
+      "class_loader::ClassLoader: Calling onPlacedPluginDeletion() for obj ptr = %p.\n",
+      reinterpret_cast<void *>(obj));
+    if (nullptr == obj) {
+      return;
+    }
+    if (impl::isStatisticsEnabled()) {
+      impl::recordInstanceDestroyed(typeid(*obj));
+    }
+    meta_object->destroyAt(obj);
+    releasePluginReference();
   }
 
+  /**
+   * @brief Throws a CreateClassException unless an instance of a class fits into the storage provided by the caller
+   */
+  template<class Base>
+  static void checkPlacementStorage(
+    const std::string & class_name, const impl::AbstractMetaObject<Base> * meta_object,
+    const void * storage, std::size_t size)
+  {
+    if (nullptr == storage || size < meta_object->objectSize() ||
+      0 != reinterpret_cast<std::uintptr_t>(storage) % meta_object->objectAlignment())
+    {
+      throw class_loader::CreateClassException(
+              "Could not create instance of type " + class_name +
+              " as the storage provided is too small or misaligned");
+    }
+  }
+
+  /**
+   * @brief Adds plugin references for instances about to be created
+   *
+   * Only the first reference, which keeps the library from being unloaded, is taken under
+   * plugin_ref_count_mutex_. Further ones are added atomically.
+   *
+   * @param count - The number of references to add
+   */
+  CLASS_LOADER_PUBLIC
+  void acquirePluginReferences(int count);
+
+  /**
+   * @brief Drops the plugin reference of a destroyed instance, unloading the library in on-demand mode if it was the last one
+   *
+   * Only the last reference is dropped under plugin_ref_count_mutex_, the library is unloaded
+   * once it is released again.
+   */
+  CLASS_LOADER_PUBLIC
+  void releasePluginReference();
+
+  /**
+   * @brief Drops the plugin references of several instances at once, like releasePluginReference()
+   * @param count - The number of references to drop
+   */
+  CLASS_LOADER_PUBLIC
+  void releasePluginReferences(int count);
+
+  /**
+   * @brief Loads the library if it is not loaded yet, taking over a pending prefetch or an idle library awaiting its delayed unload
+   */
+  CLASS_LOADER_PUBLIC
+  void ensureLibraryLoaded();
+
+  /**
+   * @brief Adds plugin references for instances about to be created, then makes sure the library is loaded (@see ensureLibraryLoaded())
+   *
+   * Taking the references first keeps the library from being unloaded by the last instance, the
+   * reaper or a residency budget until the instances are created. The caller gives them back
+   * through releasePluginReferences() if the creation fails.
+   *
+   * @param count - The number of references to add
+   */
+  CLASS_LOADER_PUBLIC
+  void acquireLoadedLibrary(int count);
+
+  /**
+   * @brief Unloads the library on behalf of the reaper, unless a plugin has been created since it was scheduled
+   * @return true if the library has been unloaded, otherwise false
+   */
+  CLASS_LOADER_PUBLIC
+  bool unloadIdleLibrary();
+
+  /**
+   * @brief Unloads the library on behalf of MultiLibraryClassLoader to stay within its residency budget
+   *
+   * Goes through the same protocol as the delayed unload of an idle library, so a plugin created
+   * concurrently cancels the eviction rather than using an unloaded library.
+   *
+   * @return true if the library has been unloaded, otherwise false
+   */
+  CLASS_LOADER_PUBLIC
+  bool evictLibrary();
+
+  /**
+   * @brief Indicates if the library must not be unloaded by evictLibrary(), as an unmanaged instance has been created from it or a non-pure plugin library has been opened
+   */
+  CLASS_LOADER_PUBLIC
+  bool isLibraryPinned();
+
+  /**
+   * @brief Gets the pool of the instances of a factory used by createPooledInstance(), creating it on first use
+   * @note The caller must hold a plugin reference, so that the pools are not drained meanwhile
+   */
+  CLASS_LOADER_PUBLIC
+  InstancePool & getInstancePool(const impl::AbstractMetaObjectBase * meta_object);
+
+  /**
+   * @brief Releases the storage cached by createPooledInstance() and the pools holding it
+   * @note No pooled instance may be left or being created, i.e. no plugin reference may be held
+   */
+  CLASS_LOADER_PUBLIC
+  void drainPooledStorage();
+
   /**
    * @brief  Generates an instance of loadable classes (i.e. class_loader).
    *
@@ -279,6 +1017,7 @@ private:
   {
     if (!managed) {
       has_unmananged_instance_been_created_ = true;
+      unmanaged_instance_created_ = true;
     }
 
     if (
@@ -294,26 +1033,99 @@ private:
         "final plugin destruction if on demand (lazy) loading/unloading mode is used."
       );
     }
-    if (!isLibraryLoaded()) {
-      loadLibrary();
-    }
+    acquireLoadedLibrary(1);
 
-    Base * obj = class_loader::impl::createInstance<Base>(derived_class_name, this);
+    Base * obj = nullptr;
+    try {
+      obj = class_loader::impl::createInstance<Base>(derived_class_name, this);
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
     assert(obj != nullptr);  // Unreachable assertion if createInstance() throws on failure
 
-    if (managed) {
+    if (!managed) {
+      // The library is pinned by the unmanaged instance, so its reference goes without unloading
       boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
-      ++plugin_ref_count_;
+      --plugin_ref_count_;
     }
 
     return obj;
   }
 
   /**
-  * @brief Getter for if an unmanaged (i.e. unsafe) instance has been created flag
-  */
-  CLASS_LOADER_PUBLIC
-  static bool hasUnmanagedInstanceBeenCreated();
+   * @brief  Generates a managed instance of a class registered with constructor arguments
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  args The constructor arguments
+   * @return A Base* to newly created plugin object
+   */
+  template<class Base, class ... Args>
+  Base * createRawInstanceWithArgs(const std::string & derived_class_name, Args && ... args)
+  {
+    if (ClassLoader::hasUnmanagedInstanceBeenCreated() && isOnDemandLoadUnloadEnabled()) {
+      CONSOLE_BRIDGE_logInform("%s",
+        "class_loader::ClassLoader: "
+        "An attempt is being made to create a managed plugin instance, "
+        "however an unmanaged instance was created within this process address space. "
+        "This means libraries for the managed instances will not be shutdown automatically on "
+        "final plugin destruction if on demand (lazy) loading/unloading mode is used."
+      );
+    }
+    acquireLoadedLibrary(1);
+    try {
+      impl::AbstractMetaObject<Base, typename std::decay<Args>::type...> * meta_object =
+        class_loader::impl::getMetaObjectForClass<Base, typename std::decay<Args>::type...>(
+        derived_class_name, this);
+      if (nullptr == meta_object) {
+        throw class_loader::CreateClassException(
+                "Could not create instance of type " + derived_class_name +
+                " with the given constructor arguments");
+      }
+      return impl::createAndRecordInstance<Base>(
+        meta_object, [&]() {return meta_object->create(std::forward<Args>(args) ...);});
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
+  }
+
+  /**
+   * @brief Generates a managed instance through a factory handle obtained from getFactory()
+   * @param  class_name The name of the class the factory creates
+   * @param  meta_object The factory of the class
+   * @param  library_generation The library generation the factory handle was created in
+   * @param  storage The storage to create the object in, nullptr to allocate it
+   * @param  size The size of storage in bytes
+   * @return A Base* to newly created plugin object
+   */
+  template<class Base>
+  Base * createRawInstanceFromFactory(
+    const std::string & class_name, impl::AbstractMetaObject<Base> * meta_object,
+    unsigned int library_generation, void * storage, std::size_t size)
+  {
+    // Holding a plugin reference keeps the library from being unloaded while we create, so the
+    // generation is checked once we have it
+    acquirePluginReferences(1);
+    if (library_generation != library_generation_) {
+      releasePluginReference();
+      throw class_loader::CreateClassException(
+              "Could not create instance of type " + class_name +
+              " as the library has been unloaded since the factory handle was created");
+    }
+
+    try {
+      if (nullptr != storage) {
+        checkPlacementStorage<Base>(class_name, meta_object, storage, size);
+      }
+      return impl::createAndRecordInstance<Base>(
+        meta_object, [meta_object, storage]() {
+          return nullptr != storage ? meta_object->createAt(storage) : meta_object->create();
+        });
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
+  }
 
   /**
    * @brief As the library may be unloaded in "on-demand load/unload" mode, unload maybe called from createInstance(). The problem is that createInstance() locks the plugin_ref_count as does unloadLibrary(). This method is the implementation of unloadLibrary but with a parameter to decide if plugin_ref_mutex_ should be locked
@@ -324,12 +1136,82 @@ private:
   int unloadLibraryInternal(bool lock_plugin_ref_count);
 
 private:
+  /**
+   * @brief The instances a Deleter hands back to a ClassLoader, either those of a pooled factory or all others.
+   */
+  struct InstancePool
+  {
+    explicit InstancePool(
+      ClassLoader * loader, const impl::AbstractMetaObjectBase * meta_object = nullptr)
+    : loader(loader), meta_object(meta_object), next(nullptr)
+    {}
+
+    /**
+     * @brief Takes the storage of a destroyed instance, nullptr if there is none
+     */
+    void * takeStorage()
+    {
+      boost::mutex::scoped_lock lock(storage_mutex);
+      if (storage.empty()) {
+        return nullptr;
+      }
+      void * reused = storage.back();
+      storage.pop_back();
+      return reused;
+    }
+
+    /**
+     * @brief Keeps the storage of a destroyed instance for the next one
+     */
+    void returnStorage(void * released)
+    {
+      boost::mutex::scoped_lock lock(storage_mutex);
+      storage.push_back(released);
+    }
+
+    ClassLoader * loader;
+    /// The factory of objects created by createPooledInstance(), nullptr for other instances
+    const impl::AbstractMetaObjectBase * meta_object;
+    /// The storage of destroyed pooled instances, reused by the next one; guarded by storage_mutex
+    std::vector<void *> storage;
+    boost::mutex storage_mutex;
+    /// The pool added before this one, see instance_pools_
+    InstancePool * next;
+  };
+
   bool ondemand_load_unload_;
+  unsigned int load_flags_;
   std::string library_path_;
-  int load_ref_count_;
+  // Note: The counts are modified under their mutex whenever they reach or leave 0, so that
+  // loading and unloading the library is serialized, but may be read without it.
+  std::atomic<int> load_ref_count_;
   boost::recursive_mutex load_ref_count_mutex_;
-  int plugin_ref_count_;
+  std::atomic<int> plugin_ref_count_;
   boost::recursive_mutex plugin_ref_count_mutex_;
+  // Incremented every time the library is unloaded, invalidates outstanding Factory handles
+  std::atomic<unsigned int> library_generation_;
+  // Delayed unloading on demand, modified under plugin_ref_count_mutex_
+  std::chrono::milliseconds unload_delay_;
+  std::atomic<bool> unload_pending_;
+  // The load started by prefetch(), if any; guarded by load_ref_count_mutex_
+  std::shared_future<void> prefetch_;
+  std::atomic<bool> prefetch_pending_;
+  // The target of the deleters of instances that are not pooled
+  InstancePool unpooled_instances_;
+  // The pools of createPooledInstance(), one per factory guarding its own storage. The list is
+  // only prepended to, so it is looked up without locking; additions are serialized by
+  // instance_pools_mutex_.
+  std::atomic<InstancePool *> instance_pools_;
+  boost::mutex instance_pools_mutex_;
+  // Set once a newer version of the library is in use; guarded by plugin_ref_count_mutex_
+  bool retired_;
+  // Set once an unmanaged instance has been created by this ClassLoader, see isLibraryPinned()
+  std::atomic<bool> unmanaged_instance_created_;
+  // The ClassLoaders of the versions loaded by reloadLibrary(), the last one is in use and
+  // published in reloaded_version_; guarded by reload_mutex_
+  std::vector<ClassLoader *> reloaded_versions_;
+  std::atomic<ClassLoader *> reloaded_version_;
+  boost::recursive_mutex reload_mutex_;
 
   CLASS_LOADER_PUBLIC
   static bool has_unmananged_instance_been_created_;
@@ -33,16 +33,25 @@
 #define CLASS_LOADER__CLASS_LOADER_CORE_HPP_
 
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <map>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <typeinfo>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "class_loader/exceptions.hpp"
+#include "class_loader/logging.hpp"
 #include "class_loader/meta_object.hpp"
+#include "class_loader/statistics.hpp"
 #include "class_loader/visibility_control.hpp"
 
 // forward declaration
@@ -67,8 +76,8 @@ namespace impl
 typedef std::string LibraryPath;
 typedef std::string ClassName;
 typedef std::string BaseClassName;
-typedef std::map<ClassName, impl::AbstractMetaObjectBase *> FactoryMap;
-typedef std::map<BaseClassName, FactoryMap> BaseToFactoryMapMap;
+typedef std::unordered_map<ClassName, impl::AbstractMetaObjectBase *> FactoryMap;
+typedef std::unordered_map<BaseClassName, FactoryMap> BaseToFactoryMapMap;
 typedef std::pair<LibraryPath, Poco::SharedLibrary *> LibraryPair;
 typedef std::vector<LibraryPair> LibraryVector;
 typedef std::vector<AbstractMetaObjectBase *> MetaObjectVector;
@@ -95,13 +104,14 @@ LibraryVector & getLoadedLibraryVector();
 
 /**
  * @brief When a library is being loaded, in order for factories to know which library they are being associated with, they use this function to query which library is being loaded.
+ * @note The loading library name and the active ClassLoader are kept per thread, as a library's factories register from the static initializers run by the thread that opens it. Libraries can hence be loaded concurrently from different threads.
  * @return The currently set loading library name as a string
  */
 CLASS_LOADER_PUBLIC
 std::string getCurrentlyLoadingLibraryName();
 
 /**
- * @brief When a library is being loaded, in order for factories to know which library they are being associated with, this function is called to set the name of the library currently being loaded.
+ * @brief When a library is being loaded, in order for factories to know which library they are being associated with, this function is called to set the name of the library currently being loaded by the calling thread.
  * @param library_name - The name of library that is being loaded currently
  */
 CLASS_LOADER_PUBLIC
@@ -116,7 +126,7 @@ CLASS_LOADER_PUBLIC
 ClassLoader * getCurrentlyActiveClassLoader();
 
 /**
- * @brief Sets the ClassLoader currently in scope which used when a library is being loaded.
+ * @brief Sets the ClassLoader currently in scope which used when a library is being loaded by the calling thread.
  * @param loader - pointer to the currently active ClassLoader.
  */
 CLASS_LOADER_PUBLIC
@@ -130,6 +140,19 @@ void setCurrentlyActiveClassLoader(ClassLoader * loader);
 CLASS_LOADER_PUBLIC
 FactoryMap & getFactoryMapForBaseClass(const std::string & typeid_base_class_name);
 
+/**
+ * @brief The FactoryMap of a base class, resolved once per base class.
+ * FactoryMaps are never removed from the global map and keep their address while other
+ * FactoryMaps are added, so the slot never has to be invalidated.
+ * @return A reference to the slot, nullptr until the FactoryMap has been resolved
+ */
+template<typename Base>
+std::atomic<FactoryMap *> & getFactoryMapSlotForBaseClass()
+{
+  static std::atomic<FactoryMap *> slot(nullptr);
+  return slot;
+}
+
 /**
  * @brief Same as above but uses a type parameter instead of string for more safety if info is available.
  * @return A reference to the FactoryMap contained within the global Base-to-FactoryMap map.
@@ -137,17 +160,53 @@ FactoryMap & getFactoryMapForBaseClass(const std::string & typeid_base_class_nam
 template<typename Base>
 FactoryMap & getFactoryMapForBaseClass()
 {
-  return getFactoryMapForBaseClass(typeid(Base).name());
+  std::atomic<FactoryMap *> & slot = getFactoryMapSlotForBaseClass<Base>();
+  FactoryMap * factory_map = slot.load(std::memory_order_acquire);
+  if (nullptr == factory_map) {
+    factory_map = &getFactoryMapForBaseClass(typeid(Base).name());
+    slot.store(factory_map, std::memory_order_release);
+  }
+  return *factory_map;
 }
 
 /**
- * @brief To provide thread safety, all exposed plugin functions can only be run serially by multiple threads. This is implemented by using critical sections enforced by a single mutex which is locked and released with the following two functions
+ * @brief Same as getFactoryMapForBaseClass() but never inserts a new FactoryMap, so it can be used while only holding a shared lock on the global plugin base to factory map.
+ * @return A pointer to the FactoryMap, nullptr if no factory has ever been registered for the base class
+ */
+CLASS_LOADER_PUBLIC
+const FactoryMap * findFactoryMapForBaseClass(const std::string & typeid_base_class_name);
+
+/**
+ * @brief Same as above but uses a type parameter instead of string for more safety if info is available.
+ * @return A pointer to the FactoryMap, nullptr if no factory has ever been registered for the base class
+ */
+template<typename Base>
+const FactoryMap * findFactoryMapForBaseClass()
+{
+  std::atomic<FactoryMap *> & slot = getFactoryMapSlotForBaseClass<Base>();
+  FactoryMap * factory_map = slot.load(std::memory_order_acquire);
+  if (nullptr == factory_map) {
+    factory_map = const_cast<FactoryMap *>(findFactoryMapForBaseClass(typeid(Base).name()));
+    if (nullptr != factory_map) {
+      slot.store(factory_map, std::memory_order_release);
+    }
+  }
+  return factory_map;
+}
+
+/**
+ * @brief To provide thread safety, all exposed plugin functions can only be run serially by multiple threads. This is implemented by using critical sections enforced by a single mutex which is locked and released with the following function
  * @return A reference to the global mutex
  */
 CLASS_LOADER_PUBLIC
 boost::recursive_mutex & getLoadedLibraryVectorMutex();
+
+/**
+ * @brief Gets the reader/writer lock protecting the global plugin base to factory map. Lookups and instance creation only take a shared lock, so they can run concurrently, while registration and library load/unload take an exclusive lock. The lock is not recursive.
+ * @return A reference to the global reader/writer lock
+ */
 CLASS_LOADER_PUBLIC
-boost::recursive_mutex & getPluginBaseToFactoryMapMapMutex();
+boost::shared_mutex & getPluginBaseToFactoryMapMapMutex();
 
 /**
  * @brief Indicates if a library containing more than just plugins has been opened by the running process
@@ -163,6 +222,13 @@ bool hasANonPurePluginLibraryBeenOpened();
 CLASS_LOADER_PUBLIC
 void hasANonPurePluginLibraryBeenOpened(bool hasIt);
 
+/**
+ * @brief Inserts a newly created factory into the FactoryMap of its base class, overwriting any factory previously registered under the same class name, and updates the registry's library and ClassLoader indices.
+ * @param meta_obj - The factory, already tagged with its owning ClassLoader and library path
+ */
+CLASS_LOADER_PUBLIC
+void registerMetaObject(AbstractMetaObjectBase * meta_obj);
+
 // Plugin Functions
 
 /**
@@ -170,22 +236,29 @@ void hasANonPurePluginLibraryBeenOpened(bool hasIt);
  * Classes that use that macro will cause this function to be invoked when the library is loaded. The function will create a MetaObject (i.e. factory) for the corresponding Derived class and insert it into the appropriate FactoryMap in the global Base-to-FactoryMap map. Note that the passed class_name is the literal class name and not the mangled version.
  * @param Derived - parameteric type indicating concrete type of plugin
  * @param Base - parameteric type indicating base type of plugin
+ * @param Args - the types of the constructor arguments of Derived, none if it is default constructed (@see CLASS_LOADER_REGISTER_CLASS_WITH_ARGS)
  * @param class_name - the literal name of the class being registered (NOT MANGLED)
  */
-template<typename Derived, typename Base>
+template<typename Derived, typename Base, typename ... Args>
 void registerPlugin(const std::string & class_name, const std::string & base_class_name)
 {
+  // Creators look factories up by the decayed types of the arguments they pass
+  static_assert(
+    std::is_same<std::tuple<Args...>, std::tuple<typename std::decay<Args>::type...>>::value,
+    "The constructor argument types of a plugin must not be references or cv-qualified");
+
   // Note: This function will be automatically invoked when a dlopen() call
   // opens a library. Normally it will happen within the scope of loadLibrary(),
   // but that may not be guaranteed.
-  CONSOLE_BRIDGE_logDebug(
+  ScopedTraceEvent trace("registerPlugin", class_name.c_str());
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Registering plugin factory for class = %s, ClassLoader* = %p and library name %s.",
     class_name.c_str(), getCurrentlyActiveClassLoader(),
     getCurrentlyLoadingLibraryName().c_str());
 
   if (nullptr == getCurrentlyActiveClassLoader()) {
-    CONSOLE_BRIDGE_logDebug("%s",
+    CLASS_LOADER_LOG_DEBUG("%s",
       "class_loader.impl: ALERT!!! "
       "A library containing plugins has been opened through a means other than through the "
       "class_loader or pluginlib package. "
@@ -205,35 +278,198 @@ void registerPlugin(const std::string & class_name, const std::string & base_cla
   }
 
   // Create factory
-  impl::AbstractMetaObject<Base> * new_factory =
-    new impl::MetaObject<Derived, Base>(class_name, base_class_name);
+  impl::AbstractMetaObject<Base, Args...> * new_factory =
+    new impl::MetaObject<Derived, Base, Args...>(class_name, base_class_name);
   new_factory->addOwningClassLoader(getCurrentlyActiveClassLoader());
   new_factory->setAssociatedLibraryPath(getCurrentlyLoadingLibraryName());
 
 
   // Add it to global factory map map
-  getPluginBaseToFactoryMapMapMutex().lock();
-  FactoryMap & factoryMap = getFactoryMapForBaseClass<Base>();
-  if (factoryMap.find(class_name) != factoryMap.end()) {
-    CONSOLE_BRIDGE_logWarn(
-      "class_loader.impl: SEVERE WARNING!!! "
-      "A namespace collision has occurred with plugin factory for class %s. "
-      "New factory will OVERWRITE existing one. "
-      "This situation occurs when libraries containing plugins are directly linked against an "
-      "executable (the one running right now generating this message). "
-      "Please separate plugins out into their own library or just don't link against the library "
-      "and use either class_loader::ClassLoader/MultiLibraryClassLoader to open.",
-      class_name.c_str());
-  }
-  factoryMap[class_name] = new_factory;
-  getPluginBaseToFactoryMapMapMutex().unlock();
+  registerMetaObject(new_factory);
 
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Registration of %s complete (Metaobject Address = %p)",
     class_name.c_str(), reinterpret_cast<void *>(new_factory));
 }
 
+/**
+ * @struct ClassTableEntry
+ * @brief A class exported by CLASS_LOADER_BEGIN_CLASS_TABLE, registered when the library is loaded through a ClassLoader.
+ *
+ * Tables are constant initialized, so unlike CLASS_LOADER_REGISTER_CLASS they do not run any
+ * static initializer when the library is opened.
+ */
+struct ClassTableEntry
+{
+  /// The literal name of the class, nullptr ends the table
+  const char * class_name;
+  /// The literal name of the base class
+  const char * base_class_name;
+  /// Creates the factory of the class
+  AbstractMetaObjectBase * (*create_meta_object)(
+    const std::string & class_name, const std::string & base_class_name);
+};
+
+/**
+ * @brief Creates the factory of a class exported through a class table (@see ClassTableEntry)
+ */
+template<typename Derived, typename Base>
+AbstractMetaObjectBase *
+createTableMetaObject(const std::string & class_name, const std::string & base_class_name)
+{
+  return new impl::MetaObject<Derived, Base>(class_name, base_class_name);
+}
+
+/**
+ * @struct FactoryLookup
+ * @brief The factory of a plugin class as seen from a ClassLoader, as found by lookupFactory()
+ */
+struct FactoryLookup
+{
+  /// The factory, which implements the interface it was looked up for; nullptr if there is none
+  AbstractMetaObjectBase * factory;
+  /// Indicates if the factory is owned by the ClassLoader it was looked up for
+  bool is_owned_by_loader;
+  /// Indicates if the factory is not owned by any ClassLoader
+  bool is_owned_by_nobody;
+};
+
+/**
+ * @brief Gets the generation of the plugin registry, which changes whenever a factory is registered or removed, or the owners of a factory change
+ * @note Only changes while the global plugin base to factory map mutex is exclusively locked
+ */
+CLASS_LOADER_PUBLIC
+uint64_t getRegistryGeneration();
+
+/**
+ * @brief Looks up the factory of a class in the lookup cache of the calling thread
+ * @param interface - The typeid of the AbstractMetaObject interface the factory was looked up for
+ * @param class_name - The name of the class
+ * @param loader - The ClassLoader the factory was looked up for
+ * @param lookup - Set to the cached lookup, if any
+ * @return true if the lookup was cached at the current registry generation, false otherwise
+ */
+CLASS_LOADER_PUBLIC
+bool findCachedFactoryLookup(
+  const std::type_info & interface, const std::string & class_name, const ClassLoader * loader,
+  FactoryLookup & lookup);
+
+/**
+ * @brief Stores the lookup of a factory in the lookup cache of the calling thread
+ * @param interface - The typeid of the AbstractMetaObject interface the factory was looked up for
+ * @param class_name - The name of the class
+ * @param loader - The ClassLoader the factory was looked up for
+ * @param lookup - The outcome of the lookup
+ * @param generation - The registry generation the lookup was made at
+ */
+CLASS_LOADER_PUBLIC
+void cacheFactoryLookup(
+  const std::type_info & interface, const std::string & class_name, const ClassLoader * loader,
+  const FactoryLookup & lookup, uint64_t generation);
+
+/**
+ * @brief Finds the version of a registered factory that is owned by a ClassLoader (@see AbstractMetaObjectBase::getShadowedVersion())
+ * @param meta_obj - The factory registered in the FactoryMap
+ * @param loader - The ClassLoader, nullptr for factories not owned by any ClassLoader
+ * @return The factory, nullptr if no version of it is owned by loader
+ * @note The caller must hold a lock on getPluginBaseToFactoryMapMapMutex()
+ */
+inline AbstractMetaObjectBase * findFactoryVersionOwnedBy(
+  AbstractMetaObjectBase * meta_obj, const ClassLoader * loader)
+{
+  while (nullptr != meta_obj && !meta_obj->isOwnedBy(loader)) {
+    meta_obj = meta_obj->getShadowedVersion();
+  }
+  return meta_obj;
+}
+
+/**
+ * @brief Looks up the factory of a plugin class and whether it is in the scope of a ClassLoader.
+ *
+ * Each thread keeps the lookups of the few classes it used last, so that creating instances of
+ * the same classes over and over does not contend on the registry lock. Cached lookups are only
+ * used as long as the registry generation has not changed (@see getRegistryGeneration()).
+ *
+ * @param Args - the types of the constructor arguments the class was registered with
+ * @param derived_class_name - The name of the derived class (unmangled)
+ * @param loader - The ClassLoader whose scope we are within
+ * @return The lookup, whose factory is an AbstractMetaObject<Base, Args...> or nullptr
+ */
+template<typename Base, typename ... Args>
+FactoryLookup lookupFactory(const std::string & derived_class_name, ClassLoader * loader)
+{
+  typedef AbstractMetaObject<Base, Args...> Interface;
+  FactoryLookup lookup;
+  if (findCachedFactoryLookup(typeid(Interface), derived_class_name, loader, lookup)) {
+    return lookup;
+  }
+
+  lookup.factory = nullptr;
+  lookup.is_owned_by_loader = false;
+  lookup.is_owned_by_nobody = false;
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+  uint64_t generation = getRegistryGeneration();
+  const FactoryMap * factory_map = findFactoryMapForBaseClass<Base>();
+  FactoryMap::const_iterator itr;
+  if (nullptr == factory_map ||
+    (itr = factory_map->find(derived_class_name)) == factory_map->end())
+  {
+    return lookup;
+  }
+  AbstractMetaObjectBase * meta_obj = findFactoryVersionOwnedBy(itr->second, loader);
+  if (nullptr == meta_obj) {
+    meta_obj = findFactoryVersionOwnedBy(itr->second, nullptr);
+  }
+  Interface * factory = dynamic_cast<Interface *>(nullptr != meta_obj ? meta_obj : itr->second);
+  if (nullptr != factory) {
+    lookup.factory = factory;
+    lookup.is_owned_by_loader = factory->isOwnedBy(loader);
+    lookup.is_owned_by_nobody = factory->isOwnedBy(nullptr);
+    cacheFactoryLookup(typeid(Interface), derived_class_name, loader, lookup, generation);
+  }
+  return lookup;
+}
+
+/**
+ * @brief This function looks up the factory of a plugin class that is within the scope of the passed ClassLoader (or not owned by any ClassLoader at all).
+ * @param Args - the types of the constructor arguments the class was registered with
+ * @param derived_class_name - The name of the derived class (unmangled)
+ * @param loader - The ClassLoader whose scope we are within
+ * @return A pointer to the factory, nullptr if there is no such factory within the loader's scope or it takes other constructor arguments
+ */
+template<typename Base, typename ... Args>
+AbstractMetaObject<Base, Args...> *
+getMetaObjectForClass(const std::string & derived_class_name, ClassLoader * loader)
+{
+  FactoryLookup lookup = lookupFactory<Base, Args...>(derived_class_name, loader);
+  if (lookup.is_owned_by_loader || lookup.is_owned_by_nobody) {
+    return static_cast<AbstractMetaObject<Base, Args...> *>(lookup.factory);
+  }
+  return nullptr;
+}
+
+/**
+ * @brief This function indicates if a plugin class derived from Base is within the scope of the passed ClassLoader (or not owned by any ClassLoader at all), whatever its constructor arguments.
+ * @param derived_class_name - The name of the derived class (unmangled)
+ * @param loader - The ClassLoader whose scope we are within
+ * @return true if the class is listed by getAvailableClasses(), false otherwise
+ */
+template<typename Base>
+bool isClassAvailable(const std::string & derived_class_name, ClassLoader * loader)
+{
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+
+  const FactoryMap * factory_map = findFactoryMapForBaseClass<Base>();
+  if (nullptr == factory_map) {
+    return false;
+  }
+  FactoryMap::const_iterator itr = factory_map->find(derived_class_name);
+  return itr != factory_map->end() &&
+         (nullptr != findFactoryVersionOwnedBy(itr->second, loader) ||
+         nullptr != findFactoryVersionOwnedBy(itr->second, nullptr));
+}
+
 /**
  * @brief This function creates an instance of a plugin class given the derived name of the class and returns a pointer of the Base class type.
  * @param derived_class_name - The name of the derived class (unmangled)
@@ -243,26 +479,23 @@ void registerPlugin(const std::string & class_name, const std::string & base_cla
 template<typename Base>
 Base * createInstance(const std::string & derived_class_name, ClassLoader * loader)
 {
-  AbstractMetaObject<Base> * factory = nullptr;
-
-  getPluginBaseToFactoryMapMapMutex().lock();
-  FactoryMap & factoryMap = getFactoryMapForBaseClass<Base>();
-  if (factoryMap.find(derived_class_name) != factoryMap.end()) {
-    factory = dynamic_cast<impl::AbstractMetaObject<Base> *>(factoryMap[derived_class_name]);
-  } else {
+  FactoryLookup lookup = lookupFactory<Base>(derived_class_name, loader);
+  AbstractMetaObject<Base> * factory = static_cast<AbstractMetaObject<Base> *>(lookup.factory);
+  bool is_owned_by_loader = lookup.is_owned_by_loader;
+  bool is_owned_by_nobody = lookup.is_owned_by_nobody;
+  if (nullptr == factory) {
     CONSOLE_BRIDGE_logError(
       "class_loader.impl: No metaobject exists for class type %s.", derived_class_name.c_str());
   }
-  getPluginBaseToFactoryMapMapMutex().unlock();
 
   Base * obj = nullptr;
-  if (factory != nullptr && factory->isOwnedBy(loader)) {
-    obj = factory->create();
+  if (factory != nullptr && is_owned_by_loader) {
+    obj = createAndRecordInstance<Base>(factory, [factory]() {return factory->create();});
   }
 
   if (nullptr == obj) {  // Was never created
-    if (factory && factory->isOwnedBy(nullptr)) {
-      CONSOLE_BRIDGE_logDebug("%s",
+    if (factory && is_owned_by_nobody) {
+      CLASS_LOADER_LOG_DEBUG("%s",
         "class_loader.impl: ALERT!!! "
         "A metaobject (i.e. factory) exists for desired class, but has no owner. "
         "This implies that the library containing the class was dlopen()ed by means other than "
@@ -273,14 +506,14 @@ Base * createInstance(const std::string & derived_class_name, ClassLoader * load
         "You should isolate your plugins into their own library, otherwise it will not be "
         "possible to shutdown the library!");
 
-      obj = factory->create();
+      obj = createAndRecordInstance<Base>(factory, [factory]() {return factory->create();});
     } else {
       throw class_loader::CreateClassException(
               "Could not create instance of type " + derived_class_name);
     }
   }
 
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: Created instance of type %s and object pointer = %p",
     (typeid(obj).name()), reinterpret_cast<void *>(obj));
 
@@ -295,27 +528,89 @@ Base * createInstance(const std::string & derived_class_name, ClassLoader * load
 template<typename Base>
 std::vector<std::string> getAvailableClasses(ClassLoader * loader)
 {
-  boost::recursive_mutex::scoped_lock lock(getPluginBaseToFactoryMapMapMutex());
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 
-  FactoryMap & factory_map = getFactoryMapForBaseClass<Base>();
+  const FactoryMap * factory_map = findFactoryMapForBaseClass<Base>();
   std::vector<std::string> classes;
   std::vector<std::string> classes_with_no_owner;
+  if (nullptr == factory_map) {
+    return classes;
+  }
 
-  for (auto & it : factory_map) {
+  for (auto & it : *factory_map) {
     AbstractMetaObjectBase * factory = it.second;
-    if (factory->isOwnedBy(loader)) {
+    if (nullptr != findFactoryVersionOwnedBy(factory, loader)) {
       classes.push_back(it.first);
-    } else if (factory->isOwnedBy(nullptr)) {
+    } else if (nullptr != findFactoryVersionOwnedBy(factory, nullptr)) {
       classes_with_no_owner.push_back(it.first);
     }
   }
 
+  // Keep the order independent of the hashing of FactoryMap
+  std::sort(classes.begin(), classes.end());
+  std::sort(classes_with_no_owner.begin(), classes_with_no_owner.end());
+
   // Added classes not associated with a class loader (Which can happen through
   // an unexpected dlopen() to the library)
   classes.insert(classes.end(), classes_with_no_owner.begin(), classes_with_no_owner.end());
   return classes;
 }
 
+/**
+ * @brief This function visits all the plugin classes derived from Base that are within scope of the passed ClassLoader.
+ * Classes owned by the loader are visited before those not owned by any ClassLoader, in no particular order otherwise.
+ * The names are collected into a buffer of the calling thread that is reused by later calls, and the callback runs
+ * after the factory map is unlocked, so it may call into class_loader, e.g. to create instances of the classes.
+ * @param loader - The pointer to the ClassLoader whose scope we are within
+ * @param callback - Invoked with the const std::string & name of each class
+ */
+template<typename Base, typename Callback>
+void forEachAvailableClass(ClassLoader * loader, Callback && callback)
+{
+  // Note: A callback that visits classes itself takes the buffer over for the time being
+  static thread_local std::vector<std::string> reused_names;
+  struct NameBuffer
+  {
+    NameBuffer() {names.swap(reused_names);}
+    ~NameBuffer() {names.swap(reused_names);}
+    std::vector<std::string> names;
+  } buffer;
+  std::vector<std::string> & names = buffer.names;
+
+  size_t num_names = 0;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+    const FactoryMap * factory_map = findFactoryMapForBaseClass<Base>();
+    if (nullptr == factory_map) {
+      return;
+    }
+    // Assigning to the names of earlier calls reuses their storage
+    auto append = [&names, &num_names](const std::string & class_name) {
+        if (num_names < names.size()) {
+          names[num_names].assign(class_name);
+        } else {
+          names.push_back(class_name);
+        }
+        ++num_names;
+      };
+    for (auto & it : *factory_map) {
+      if (nullptr != findFactoryVersionOwnedBy(it.second, loader)) {
+        append(it.first);
+      }
+    }
+    for (auto & it : *factory_map) {
+      if (nullptr == findFactoryVersionOwnedBy(it.second, loader) &&
+        nullptr != findFactoryVersionOwnedBy(it.second, nullptr))
+      {
+        append(it.first);
+      }
+    }
+  }
+  for (size_t i = 0; i < num_names; ++i) {
+    callback(static_cast<const std::string &>(names[i]));
+  }
+}
+
 /**
  * @brief This function returns the names of all libraries in use by a given class loader.
  * @param loader - The ClassLoader whose scope we are within
@@ -324,6 +619,15 @@ std::vector<std::string> getAvailableClasses(ClassLoader * loader)
 CLASS_LOADER_PUBLIC
 std::vector<std::string> getAllLibrariesUsedByClassLoader(const ClassLoader * loader);
 
+/**
+ * @brief This function returns all classes registered by a library that has been loaded.
+ * @param library_path - The path+name of the library
+ * @return A vector of (typeid(Base).name(), class name) pairs, one for each factory the library registered
+ */
+CLASS_LOADER_PUBLIC
+std::vector<std::pair<BaseClassName, ClassName>>
+getAllClassesForLibrary(const std::string & library_path);
+
 /**
  * @brief Indicates if passed library loaded within scope of a ClassLoader. The library maybe loaded in memory, but to the class loader it may not be.
  * @param library_path - The name of the library we wish to check is open
@@ -341,6 +645,62 @@ bool isLibraryLoaded(const std::string & library_path, ClassLoader * loader);
 CLASS_LOADER_PUBLIC
 bool isLibraryLoadedByAnybody(const std::string & library_path);
 
+/**
+ * @brief Finds the file the dynamic loader would open for a library. Libraries given without a directory are looked up in LD_LIBRARY_PATH first.
+ * @param library_path - The name of the library
+ * @return The path of the readable library file, or an empty string if none was found
+ */
+CLASS_LOADER_PUBLIC
+std::string findLibraryFile(const std::string & library_path);
+
+/**
+ * @brief Reserves a path for a copy of a library in a new private temporary directory, so that it can be opened next to the version already loaded (@see ClassLoader::reloadLibrary()). The copy is made from the file the loaded library was mapped from whenever the path is opened, and unlinked again once it is mapped. Factories registered from the copy shadow those of the library without a namespace collision warning.
+ * @param library_path - The name of the library
+ * @return The path of the copy
+ * @throws class_loader::LibraryLoadException if the library file cannot be found or the directory cannot be created
+ */
+CLASS_LOADER_PUBLIC
+std::string createLibraryVersion(const std::string & library_path);
+
+/**
+ * @brief Forgets a copy of a library made by createLibraryVersion(), deleting its directory and graveyarded factories, once it is unloaded
+ * @param version_path - The path of the copy
+ */
+CLASS_LOADER_PUBLIC
+void removeLibraryVersion(const std::string & version_path);
+
+/**
+ * @brief Indicates if the factories registered by a loaded library run its own code, rather than that of an earlier version whose exported symbols interpose those of the library. Only implemented on Linux, true elsewhere.
+ * @param library_path - The name of the library
+ * @return false if the code of a factory resolves to another library, otherwise true
+ */
+CLASS_LOADER_PUBLIC
+bool areFactoriesOfLibrary(const std::string & library_path);
+
+/**
+ * @brief Reads a library file into the page cache ahead of loading it, so that the dynamic loader does not stall on page faults while it is holding the library loading lock. Libraries given without a directory are looked up in LD_LIBRARY_PATH. Failures are ignored as the library will be properly reported as missing by loadLibrary().
+ *
+ * The file is mapped with a readahead hint and all of its pages are touched. With
+ * prefetch_dependencies, the libraries named by its DT_NEEDED entries which are not loaded in the
+ * process yet are prefetched the same way, recursively. Dependencies are looked up in DT_RPATH,
+ * LD_LIBRARY_PATH, DT_RUNPATH and the default library directories; ones only found through
+ * /etc/ld.so.cache are not prefetched.
+ *
+ * @param library_path - The name of the library to prefetch
+ * @param prefetch_dependencies - Indicates if the dependencies of the library are prefetched as well
+ * @return true if the library file was found and read, otherwise false
+ */
+CLASS_LOADER_PUBLIC
+bool prefetchLibrary(const std::string & library_path, bool prefetch_dependencies = false);
+
+/**
+ * @brief Gets the size of the address space a library occupies in this process, i.e. its loadable segments rounded to pages. Only implemented on Linux.
+ * @param library_path - The name of the library
+ * @return The mapped size in bytes, 0 if the library is not mapped or the size is unknown
+ */
+CLASS_LOADER_PUBLIC
+std::size_t getLibraryMappedSize(const std::string & library_path);
+
 /**
  * @brief Loads a library into memory if it has not already been done so. Attempting to load an already loaded library has no effect.
  * @param library_path - The name of the library to open
@@ -357,6 +717,24 @@ void loadLibrary(const std::string & library_path, ClassLoader * loader);
 CLASS_LOADER_PUBLIC
 void unloadLibrary(const std::string & library_path, ClassLoader * loader);
 
+/**
+ * @brief Enables or disables fast exit mode, in which unloading a library only unbinds its factories but never closes it.
+ *
+ * Closing hundreds of libraries runs all of their static destructors and makes the dynamic
+ * loader walk its dependency graph for each of them. Enable this when the process is about to
+ * exit, the libraries are then unmapped by the exit itself. Fast exit mode is also enabled by
+ * setting the CLASS_LOADER_FAST_EXIT environment variable to 1. Libraries unloaded while it is
+ * enabled stay mapped, loading them again revives their factories from the graveyard.
+ */
+CLASS_LOADER_PUBLIC
+void setFastExitEnabled(bool enabled);
+
+/**
+ * @brief Indicates if fast exit mode is enabled (@see setFastExitEnabled())
+ */
+CLASS_LOADER_PUBLIC
+bool isFastExitEnabled();
+
 }  // namespace impl
 }  // namespace class_loader
 
@@ -0,0 +1,71 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CLASS_LOADER__LOGGING_HPP_
+#define CLASS_LOADER__LOGGING_HPP_
+
+#include "console_bridge/console.h"
+
+/**
+ * @note Debug messages are logged on the load, create and destroy paths. To keep them cheap, they
+ * go through CLASS_LOADER_LOG_DEBUG(), which only formats its arguments if console_bridge is set
+ * to the debug level, and which is compiled out entirely if CLASS_LOADER_LOG_LEVEL is above
+ * CLASS_LOADER_LOG_LEVEL_DEBUG. CLASS_LOADER_LOG_LEVEL defaults to CLASS_LOADER_LOG_LEVEL_INFO
+ * when NDEBUG is defined and to CLASS_LOADER_LOG_LEVEL_DEBUG otherwise.
+ *
+ * Informational messages, warnings and errors are always logged through console_bridge.
+ */
+
+#define CLASS_LOADER_LOG_LEVEL_DEBUG 0
+#define CLASS_LOADER_LOG_LEVEL_INFO 1
+
+#ifndef CLASS_LOADER_LOG_LEVEL
+#ifdef NDEBUG
+#define CLASS_LOADER_LOG_LEVEL CLASS_LOADER_LOG_LEVEL_INFO
+#else
+#define CLASS_LOADER_LOG_LEVEL CLASS_LOADER_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#if CLASS_LOADER_LOG_LEVEL <= CLASS_LOADER_LOG_LEVEL_DEBUG
+#define CLASS_LOADER_LOG_DEBUG(...) \
+  do { \
+    if (console_bridge::getLogLevel() <= console_bridge::CONSOLE_BRIDGE_LOG_DEBUG) { \
+      CONSOLE_BRIDGE_logDebug(__VA_ARGS__); \
+    } \
+  } while (false)
+#else
+#define CLASS_LOADER_LOG_DEBUG(...) \
+  do { \
+  } while (false)
+#endif
+
+#endif  // CLASS_LOADER__LOGGING_HPP_
@@ -0,0 +1,108 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CLASS_LOADER__MANIFEST_CACHE_HPP_
+#define CLASS_LOADER__MANIFEST_CACHE_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "class_loader/class_loader_core.hpp"
+#include "class_loader/visibility_control.hpp"
+
+/**
+ * @note This file is used internally by MultiLibraryClassLoader.
+ *
+ * The manifest cache records, for every library that has been opened, the classes the library
+ * registers. It allows to find out which library exports a class without opening any library,
+ * e.g. when on-demand load/unload is enabled. An entry is only used as long as the library file
+ * has the same device, inode, modification time and size as when the entry was recorded.
+ *
+ * The cache is disabled unless a cache file is configured, either through the
+ * CLASS_LOADER_MANIFEST_CACHE environment variable or through setManifestCachePath().
+ *
+ * Recorded manifests are kept in memory until flushManifestCache() is called, which
+ * MultiLibraryClassLoader does once per batch of libraries and when it is destroyed, and at
+ * process exit at the latest. The file is then merged with the manifests other processes wrote
+ * in the meantime, under a lock file next to it, and replaced atomically.
+ */
+
+namespace class_loader
+{
+namespace impl
+{
+
+/**
+ * @brief Sets the file in which library manifests are cached, replacing the one given by the CLASS_LOADER_MANIFEST_CACHE environment variable
+ * @param cache_path - The path of the cache file, an empty string disables the cache
+ */
+CLASS_LOADER_PUBLIC
+void setManifestCachePath(const std::string & cache_path);
+
+/**
+ * @brief Returns the file in which library manifests are cached, empty if the cache is disabled
+ */
+CLASS_LOADER_PUBLIC
+std::string getManifestCachePath();
+
+/**
+ * @brief Looks up the classes a library registers in the manifest cache
+ * @param library_path - The path+name of the library
+ * @param classes - Set to the (typeid(Base).name(), class name) pairs of the library if found
+ * @return true if the cache holds an up to date manifest for the library, otherwise false
+ */
+CLASS_LOADER_PUBLIC
+bool findCachedManifest(
+  const std::string & library_path,
+  std::vector<std::pair<BaseClassName, ClassName>> & classes);
+
+/**
+ * @brief Records the classes a library registers in the manifest cache, they are written to the cache file by flushManifestCache()
+ * @param library_path - The path+name of the library
+ * @param classes - The (typeid(Base).name(), class name) pairs of the library
+ */
+CLASS_LOADER_PUBLIC
+void cacheManifest(
+  const std::string & library_path,
+  const std::vector<std::pair<BaseClassName, ClassName>> & classes);
+
+/**
+ * @brief Writes the manifests recorded since the last flush to the cache file
+ * @return false if the cache file could not be written, otherwise true
+ */
+CLASS_LOADER_PUBLIC
+bool flushManifestCache();
+
+}  // namespace impl
+}  // namespace class_loader
+
+#endif  // CLASS_LOADER__MANIFEST_CACHE_HPP_
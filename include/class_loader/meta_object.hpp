@@ -38,8 +38,12 @@
 #include <console_bridge/console.h>
 #include "class_loader/visibility_control.hpp"
 
+#include <cstddef>
+#include <new>
 #include <typeinfo>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace class_loader
@@ -124,6 +128,17 @@ public:
    */
   ClassLoaderVector getAssociatedClassLoaders();
 
+  /**
+   * @brief Gets the factory of the same class from another version of the library that this one shadows in the registry. It stays in use by the ClassLoaders that own it (@see ClassLoader::reloadLibrary()).
+   * @return The shadowed factory, nullptr if there is none
+   */
+  AbstractMetaObjectBase * getShadowedVersion() const;
+
+  /**
+   * @brief Sets the factory this one shadows in the registry (@see getShadowedVersion())
+   */
+  void setShadowedVersion(AbstractMetaObjectBase * meta_obj);
+
 protected:
   /**
    * This is needed to make base class polymorphic (i.e. have a vtable)
@@ -136,14 +151,16 @@ protected:
   std::string base_class_name_;
   std::string class_name_;
   std::string typeid_base_class_name_;
+  AbstractMetaObjectBase * shadowed_version_;
 };
 
 /**
  * @class AbstractMetaObject
  * @brief Abstract base class for factories where polymorphic type variable indicates base class for plugin interface.
  * @parm B The base class interface for the plugin
+ * @parm Args The types of the constructor arguments, none for default constructed plugins
  */
-template<class B>
+template<class B, class ... Args>
 class AbstractMetaObject : public AbstractMetaObjectBase
 {
 public:
@@ -159,12 +176,38 @@ public:
 
   /**
    * @brief Defines the factory interface that the MetaObject must implement.
+   * @param args The constructor arguments
    * @return A pointer of parametric type B to a newly created object.
    */
-  virtual B * create() const = 0;
+  virtual B * create(Args ... args) const = 0;
   /// Create a new instance of a class.
   /// Cannot be used for singletons.
 
+  /**
+   * @brief Gets the size of the objects created by this factory
+   */
+  virtual std::size_t objectSize() const = 0;
+
+  /**
+   * @brief Gets the alignment required by the objects created by this factory
+   */
+  virtual std::size_t objectAlignment() const = 0;
+
+  /**
+   * @brief Creates an object in storage provided by the caller.
+   * @param storage At least objectSize() bytes aligned to objectAlignment()
+   * @param args The constructor arguments
+   * @return A pointer of parametric type B to the newly created object.
+   */
+  virtual B * createAt(void * storage, Args ... args) const = 0;
+
+  /**
+   * @brief Destroys an object created by createAt() without releasing its storage.
+   * @param obj The object to destroy
+   * @return The storage the object was created in
+   */
+  virtual void * destroyAt(B * obj) const = 0;
+
 private:
   AbstractMetaObject();
   AbstractMetaObject(const AbstractMetaObject &);
@@ -176,16 +219,17 @@ private:
  * @brief The actual factory.
  * @parm C The derived class (the actual plugin)
  * @parm B The base class interface for the plugin
+ * @parm Args The types of the arguments forwarded to the constructor of C
  */
-template<class C, class B>
-class MetaObject : public AbstractMetaObject<B>
+template<class C, class B, class ... Args>
+class MetaObject : public AbstractMetaObject<B, Args...>
 {
 public:
   /**
    * @brief Constructor for the class
    */
   MetaObject(const std::string & class_name, const std::string & base_class_name)
-  : AbstractMetaObject<B>(class_name, base_class_name)
+  : AbstractMetaObject<B, Args...>(class_name, base_class_name)
   {
   }
 
@@ -193,9 +237,43 @@ public:
    * @brief The factory interface to generate an object. The object has type C in reality, though a pointer of the base class type is returned.
    * @return A pointer to a newly created plugin with the base class type (type parameter B)
    */
-  B * create() const
+  B * create(Args ... args) const
+  {
+    return new C(std::forward<Args>(args) ...);
+  }
+
+  std::size_t objectSize() const
+  {
+    return sizeof(C);
+  }
+
+  std::size_t objectAlignment() const
+  {
+    return alignof(C);
+  }
+
+  B * createAt(void * storage, Args ... args) const
+  {
+    return new (storage) C(std::forward<Args>(args) ...);
+  }
+
+  void * destroyAt(B * obj) const
+  {
+    C * object = toDerived(obj, std::is_polymorphic<B>());
+    object->~C();
+    return object;
+  }
+
+private:
+  static C * toDerived(B * obj, std::true_type /* polymorphic */)
+  {
+    // Unlike a static_cast, this also finds the complete object when B is a virtual base of C
+    return static_cast<C *>(dynamic_cast<void *>(obj));
+  }
+
+  static C * toDerived(B * obj, std::false_type /* polymorphic */)
   {
-    return new C;
+    return static_cast<C *>(obj);
   }
 };
 
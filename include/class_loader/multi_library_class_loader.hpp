@@ -33,13 +33,21 @@
 #define CLASS_LOADER__MULTI_LIBRARY_CLASS_LOADER_HPP_
 
 #include <boost/thread.hpp>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <future>
 #include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "console_bridge/console.h"
 #include "class_loader/class_loader.hpp"
+#include "class_loader/logging.hpp"
 #include "class_loader/visibility_control.hpp"
 
 namespace class_loader
@@ -49,6 +57,55 @@ typedef std::string LibraryPath;
 typedef std::map<LibraryPath, class_loader::ClassLoader *> LibraryToClassLoaderMap;
 typedef std::vector<ClassLoader *> ClassLoaderVector;
 
+/**
+ * @struct ClassIndexEntry
+ * @brief A class exported by the library of a ClassLoader, see MultiLibraryClassLoader::Snapshot::class_index
+ */
+struct ClassIndexEntry
+{
+  /// typeid(Base).name() of the base class the class was registered with
+  std::string typeid_base_class_name;
+  /// The ClassLoader bound to the library that exports the class
+  ClassLoader * loader;
+};
+typedef std::unordered_map<std::string, std::vector<ClassIndexEntry>> ClassToClassLoaderIndex;
+
+/**
+ * @struct LibraryLoadResult
+ * @brief The outcome of loading a single library through MultiLibraryClassLoader::loadLibraries()
+ */
+struct LibraryLoadResult
+{
+  /// The library path as passed to loadLibraries()
+  std::string library_path;
+  /// Indicates if the library is bound to the MultiLibraryClassLoader
+  bool success;
+  /// The error message if the library could not be loaded, empty otherwise
+  std::string error;
+  /// Time spent reading the library file into the page cache
+  std::chrono::nanoseconds prefetch_time;
+  /// Time spent creating the ClassLoader, i.e. opening the library unless on-demand load/unload is enabled
+  std::chrono::nanoseconds load_time;
+};
+
+/**
+ * @struct ResidencyStatistics
+ * @brief The memory used by the libraries of a MultiLibraryClassLoader, see MultiLibraryClassLoader::setResidencyBudget()
+ */
+struct ResidencyStatistics
+{
+  /// The configured budget in bytes, 0 if unlimited
+  std::size_t budget;
+  /// The mapped size of all loaded libraries in bytes
+  std::size_t resident_size;
+  /// The number of loaded libraries
+  std::size_t resident_libraries;
+  /// The number of loaded libraries which cannot be unloaded to stay within the budget
+  std::size_t pinned_libraries;
+  /// The number of times a library was unloaded to stay within the budget
+  std::size_t evictions;
+};
+
 /**
 * @class MultiLibraryClassLoader
 * @brief A ClassLoader that can bind more than one runtime library
@@ -59,8 +116,10 @@ public:
   /**
    * @brief Constructor for the class
    * @param enable_ondemand_loadunload - Flag indicates if classes are to be loaded/unloaded automatically as class_loader are created and destroyed
+   * @param load_flags - The LibraryLoadFlags passed to the ClassLoader of every library
    */
-  explicit MultiLibraryClassLoader(bool enable_ondemand_loadunload);
+  explicit MultiLibraryClassLoader(
+    bool enable_ondemand_loadunload, unsigned int load_flags = LIBRARY_LOAD_DEFAULT);
 
   /**
   * @brief Virtual destructor for class
@@ -77,7 +136,7 @@ public:
   template<class Base>
   std::shared_ptr<Base> createSharedInstance(const std::string & class_name)
   {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader::MultiLibraryClassLoader: "
       "Attempting to create instance of class type %s.",
       class_name.c_str());
@@ -112,6 +171,7 @@ public:
               "MultiLibraryClassLoader bound to library " + library_path +
               " Ensure you called MultiLibraryClassLoader::loadLibrary()");
     }
+    touchClassLoader(loader);
     return loader->createSharedInstance<Base>(class_name);
   }
 
@@ -122,7 +182,7 @@ public:
   template<class Base>
   boost::shared_ptr<Base> createInstance(const std::string & class_name)
   {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader::MultiLibraryClassLoader: "
       "Attempting to create instance of class type %s.",
       class_name.c_str());
@@ -153,6 +213,7 @@ public:
               "MultiLibraryClassLoader bound to library " + library_path +
               " Ensure you called MultiLibraryClassLoader::loadLibrary()");
     }
+    touchClassLoader(loader);
     return loader->createInstance<Base>(class_name);
   }
 
@@ -163,7 +224,7 @@ public:
   template<class Base>
   ClassLoader::UniquePtr<Base> createUniqueInstance(const std::string & class_name)
   {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader::MultiLibraryClassLoader: Attempting to create instance of class type %s.",
       class_name.c_str());
     ClassLoader * loader = getClassLoaderForClass<Base>(class_name);
@@ -192,9 +253,52 @@ public:
               "MultiLibraryClassLoader bound to library " + library_path +
               " Ensure you called MultiLibraryClassLoader::loadLibrary()");
     }
+    touchClassLoader(loader);
     return loader->createUniqueInstance<Base>(class_name);
   }
 
+  /**
+   * @brief Creates several instances of an object of given class name with ancestor class Base
+   * Same as createUniqueInstance() except that the class is looked up once for all instances.
+   * @param Base - polymorphic type indicating base class
+   * @param class_name - the name of the concrete plugin class we want to instantiate
+   * @param count - the number of instances to create
+   * @return A vector of count std::unique_ptr<Base> to newly created plugins
+   */
+  template<class Base>
+  std::vector<ClassLoader::UniquePtr<Base>>
+  createInstances(const std::string & class_name, std::size_t count)
+  {
+    ClassLoader * loader = getClassLoaderForClass<Base>(class_name);
+    if (nullptr == loader) {
+      throw class_loader::CreateClassException(
+              "MultiLibraryClassLoader: Could not create object of class type " + class_name +
+              " as no factory exists for it. "
+              "Make sure that the library exists and was explicitly loaded through "
+              "MultiLibraryClassLoader::loadLibrary()");
+    }
+    return loader->createInstances<Base>(class_name, count);
+  }
+
+  /**
+   * @brief Creates several instances of an object of given class name with ancestor class Base
+   * Same as createInstances() except it takes a specific library to make explicit the factory being used.
+   */
+  template<class Base>
+  std::vector<ClassLoader::UniquePtr<Base>> createInstances(
+    const std::string & class_name, const std::string & library_path, std::size_t count)
+  {
+    ClassLoader * loader = getClassLoaderForLibrary(library_path);
+    if (nullptr == loader) {
+      throw class_loader::NoClassLoaderExistsException(
+              "Could not create instance as there is no ClassLoader in "
+              "MultiLibraryClassLoader bound to library " + library_path +
+              " Ensure you called MultiLibraryClassLoader::loadLibrary()");
+    }
+    touchClassLoader(loader);
+    return loader->createInstances<Base>(class_name, count);
+  }
+
   /**
    * @brief Creates an instance of an object of given class name with ancestor class Base
    * This version does not look in a specific library for the factory, but rather the first open library that defines the classs
@@ -232,6 +336,7 @@ public:
               "bound to library " + library_path +
               " Ensure you called MultiLibraryClassLoader::loadLibrary()");
     }
+    touchClassLoader(loader);
     return loader->createUnmanagedInstance<Base>(class_name);
   }
 
@@ -244,9 +349,16 @@ public:
   template<class Base>
   bool isClassAvailable(const std::string & class_name)
   {
-    std::vector<std::string> available_classes = getAvailableClasses<Base>();
-    return available_classes.end() != std::find(
-      available_classes.begin(), available_classes.end(), class_name);
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    for (auto & loader : snapshot->loaders) {
+      if (loader->isLibraryLoaded() ?
+        loader->isClassAvailable<Base>(class_name) :
+        isClassIndexed(*snapshot, loader, class_name, typeid(Base).name()))
+      {
+        return true;
+      }
+    }
+    return false;
   }
 
   /**
@@ -265,14 +377,39 @@ public:
   std::vector<std::string> getAvailableClasses()
   {
     std::vector<std::string> available_classes;
-    for (auto & loader : getAllAvailableClassLoaders()) {
-      std::vector<std::string> loader_classes = loader->getAvailableClasses<Base>();
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    for (auto & loader : snapshot->loaders) {
+      // Libraries that are not open are answered from the class index, if known
+      std::vector<std::string> loader_classes = loader->isLibraryLoaded() ?
+        loader->getAvailableClasses<Base>() :
+        getIndexedClasses(*snapshot, loader, typeid(Base).name());
       available_classes.insert(
         available_classes.end(), loader_classes.begin(), loader_classes.end());
     }
     return available_classes;
   }
 
+  /**
+   * @brief Visits all classes that are loaded by the class loader without allocating their names
+   * Libraries are visited in the order of getAvailableClasses(), the classes of a library in no
+   * particular order. The callback runs without the registry locked, so it may create instances,
+   * but it must not load or unload libraries of this MultiLibraryClassLoader.
+   * @param Base - polymorphic type indicating Base class
+   * @param callback - Invoked with the const std::string & name of each class
+   */
+  template<class Base, typename Callback>
+  void forEachAvailableClass(Callback && callback)
+  {
+    std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+    for (auto & loader : snapshot->loaders) {
+      if (loader->isLibraryLoaded()) {
+        loader->forEachAvailableClass<Base>(callback);
+      } else {
+        forEachIndexedClass(*snapshot, loader, typeid(Base).name(), callback);
+      }
+    }
+  }
+
   /**
    * @brief Gets a list of all classes loaded for a particular library
    * @param Base - polymorphic type indicating Base class
@@ -303,13 +440,78 @@ public:
    */
   void loadLibrary(const std::string & library_path);
 
+  /**
+   * @brief Loads several libraries into memory for this class loader.
+   *
+   * The library files are read into the page cache by a pool of worker threads, overlapping the
+   * I/O of some libraries with the opening of others. Errors do not abort the batch, they are
+   * reported in the result of the respective library instead. Exceptions other than
+   * ClassLoaderException stop the batch and are rethrown once the workers are done. The libraries
+   * opened so far are bound to this class loader together, once the workers are done.
+   *
+   * @param library_paths - the fully qualified paths to the runtime libraries
+   * @return The outcome of loading each library, in the same order as library_paths
+   */
+  std::vector<LibraryLoadResult> loadLibraries(const std::vector<std::string> & library_paths);
+
+  /**
+   * @brief Warms up libraries bound to this class loader by loading them on background threads
+   *
+   * Meant for on-demand load/unload mode, so that the first instance of a class from one of the
+   * libraries does not pay for opening it (@see ClassLoader::prefetch()). Libraries which are not
+   * bound to this class loader through loadLibrary() are ignored.
+   *
+   * @param library_paths - the libraries that are likely to be used soon
+   * @return The futures of the loads that have been started or are still in progress
+   */
+  std::vector<std::shared_future<void>> prefetchLibraries(
+    const std::vector<std::string> & library_paths);
+
   /**
    * @brief Unloads a library for this class loader
    * @param library_path - the fully qualified path to the runtime library
    */
   int unloadLibrary(const std::string & library_path);
 
+  /**
+   * @brief Limits the address space used by the libraries of this class loader
+   *
+   * Whenever a library is used to create an instance, the least recently used other libraries
+   * without live instances are unloaded until the mapped size of all loaded libraries fits into
+   * the budget. They stay bound and are loaded again when needed. Instances may be created
+   * concurrently, a library is not unloaded once an instance is being created from it. A library
+   * is pinned, i.e. never unloaded, once an unmanaged instance has been created from it, and all
+   * libraries are once a library with plugins outside of any ClassLoader has been opened in this
+   * process, as they could not be closed.
+   *
+   * @param budget - The budget in bytes, 0 (the default) disables it
+   */
+  void setResidencyBudget(std::size_t budget);
+
+  /**
+   * @brief Gets the memory used by the libraries of this class loader (@see setResidencyBudget())
+   */
+  ResidencyStatistics getResidencyStatistics();
+
 private:
+  /**
+   * @struct Snapshot
+   * @brief The bound libraries and their classes
+   * A published snapshot is never modified, changes are made to a copy which then replaces it, so
+   * lookups neither lock nor copy anything.
+   */
+  struct Snapshot
+  {
+    // library path -> ClassLoader bound to it
+    std::unordered_map<LibraryPath, ClassLoader *> loaders_by_library;
+    // the bound class loaders, in library path order
+    ClassLoaderVector loaders;
+    // class name -> libraries exporting it, in library path order
+    ClassToClassLoaderIndex class_index;
+    // class names added to class_index for each indexed ClassLoader
+    std::map<ClassLoader *, std::vector<std::string>> indexed_class_loaders;
+  };
+
   /**
    * @brief Indicates if on-demand (lazy) load/unload is enabled so libraries are loaded/unloaded automatically as needed
    */
@@ -330,23 +532,196 @@ private:
   template<typename Base>
   ClassLoader * getClassLoaderForClass(const std::string & class_name)
   {
-    ClassLoaderVector loaders = getAllAvailableClassLoaders();
-    for (ClassLoaderVector::iterator i = loaders.begin(); i != loaders.end(); ++i) {
-      if (!(*i)->isLibraryLoaded()) {
-        (*i)->loadLibrary();
+    ClassLoader * loader = findIndexedClassLoader(class_name, typeid(Base).name());
+    if (nullptr == loader) {
+      loader = discoverClassLoaderForClass(class_name, typeid(Base).name());
+    }
+    if (nullptr == loader) {
+      // Classes registered by libraries opened outside of any ClassLoader are not indexed
+      // but remain available through every ClassLoader
+      std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+      if (!snapshot->loaders.empty() &&
+        snapshot->loaders.front()->isClassAvailable<Base>(class_name))
+      {
+        loader = snapshot->loaders.front();
       }
-      if ((*i)->isClassAvailable<Base>(class_name)) {
-        return *i;
+    }
+    if (nullptr != loader) {
+      touchClassLoader(loader);
+    }
+    return loader;
+  }
+
+  /**
+   * @brief Looks up the class loader of the first library (by path) that exports a class
+   * @param class_name - name of the class
+   * @param typeid_base_class_name - typeid(Base).name() of the base class
+   * @return A pointer to the ClassLoader*, == nullptr if no indexed library exports the class
+   */
+  ClassLoader * findIndexedClassLoader(
+    const std::string & class_name, const char * typeid_base_class_name);
+
+  /**
+   * @brief Indexes the libraries that were not opened yet until one exports the class
+   * Libraries are only opened if on-demand load/unload is enabled, and those which do not export
+   * the class are closed again.
+   * @param class_name - name of the class
+   * @param typeid_base_class_name - typeid(Base).name() of the base class
+   * @return A pointer to the ClassLoader*, == nullptr if no library exports the class
+   */
+  ClassLoader * discoverClassLoaderForClass(
+    const std::string & class_name, const char * typeid_base_class_name);
+
+  /**
+   * @brief Indicates if the class index of a snapshot records that a library exports a class
+   * @param snapshot - the snapshot to look into
+   * @param loader - the ClassLoader bound to the library
+   * @param class_name - name of the class
+   * @param typeid_base_class_name - typeid(Base).name() of the base class
+   */
+  static bool isClassIndexed(
+    const Snapshot & snapshot, ClassLoader * loader, const std::string & class_name,
+    const char * typeid_base_class_name);
+
+  /**
+   * @brief Visits the indexed classes of a library
+   * @param snapshot - the snapshot to look into
+   * @param loader - the ClassLoader bound to the library
+   * @param typeid_base_class_name - typeid(Base).name() of the base class
+   * @param callback - Invoked with the name of each class with the given base class
+   */
+  template<typename Callback>
+  static void forEachIndexedClass(
+    const Snapshot & snapshot, ClassLoader * loader, const char * typeid_base_class_name,
+    Callback && callback)
+  {
+    std::map<ClassLoader *, std::vector<std::string>>::const_iterator itr =
+      snapshot.indexed_class_loaders.find(loader);
+    if (itr == snapshot.indexed_class_loaders.end()) {
+      return;
+    }
+    for (auto & class_name : itr->second) {
+      if (isClassIndexed(snapshot, loader, class_name, typeid_base_class_name)) {
+        callback(class_name);
       }
     }
-    return nullptr;
   }
 
+  /**
+   * @brief Gets the indexed classes of a library
+   * @param snapshot - the snapshot to look into
+   * @param loader - the ClassLoader bound to the library
+   * @param typeid_base_class_name - typeid(Base).name() of the base class
+   * @return The names of the classes with the given base class
+   */
+  static std::vector<std::string> getIndexedClasses(
+    const Snapshot & snapshot, ClassLoader * loader, const char * typeid_base_class_name);
+
+  /**
+   * @brief Finds the classes of a library to add to the class index
+   * The classes of an open library are recorded in the manifest cache, those of a library that is
+   * not open are taken from the manifest cache if it knows the library.
+   * @param loader - the ClassLoader of the library
+   * @param classes - Set to the (typeid(Base).name(), class name) pairs exported by the library
+   * @return false if the classes are unknown as the library is not open and not in the cache
+   */
+  static bool findClassesToIndex(
+    ClassLoader * loader, std::vector<std::pair<std::string, std::string>> & classes);
+
+  /**
+   * @brief Adds the classes of a library to the class index
+   * @param loader - the ClassLoader bound to the library
+   */
+  void indexClassLoader(ClassLoader * loader);
+
+  /**
+   * @brief Adds classes of a library to the class index
+   * @param loader - the ClassLoader bound to the library
+   * @param classes - the (typeid(Base).name(), class name) pairs exported by the library
+   */
+  void addClassLoaderToIndex(
+    ClassLoader * loader, const std::vector<std::pair<std::string, std::string>> & classes);
+
+  /**
+   * @brief Adds classes of a library to the class index of a snapshot
+   * @param snapshot - the copy of the snapshot to modify
+   * @param loader - the ClassLoader bound to the library, not indexed in the snapshot yet
+   * @param classes - the (typeid(Base).name(), class name) pairs exported by the library
+   */
+  static void addClassesToIndex(
+    Snapshot & snapshot, ClassLoader * loader,
+    const std::vector<std::pair<std::string, std::string>> & classes);
+
+  /**
+   * @brief Removes the classes of a library from the class index of a snapshot
+   * @param snapshot - the copy of the snapshot to modify
+   * @param loader - the ClassLoader bound to the library
+   */
+  static void removeClassLoaderFromIndex(Snapshot & snapshot, ClassLoader * loader);
+
+  /**
+   * @brief Records the use of a library and unloads others if the residency budget is exceeded
+   * @param loader - the ClassLoader about to create an instance, it is never unloaded here
+   */
+  void touchClassLoader(ClassLoader * loader);
+
+  /**
+   * @brief Unloads least recently used libraries until the residency budget is met
+   * @param in_use - A ClassLoader which must not be unloaded
+   */
+  void enforceResidencyBudget(ClassLoader * in_use);
+
+  /**
+   * @brief Gets the mapped size of a library, measured when it was last loaded
+   * @note The caller must hold loader_mutex_
+   */
+  std::size_t getMappedSize(ClassLoader * loader);
+
   /**
    * @brief Gets all class loaders loaded within scope
    */
   ClassLoaderVector getAllAvailableClassLoaders();
 
+  /**
+   * @brief Gets the current snapshot of the bound libraries
+   */
+  std::shared_ptr<const Snapshot> getSnapshot() const {return std::atomic_load(&snapshot_);}
+
+  /**
+   * @brief Replaces the snapshot of the bound libraries with a modified copy
+   * @note The caller must hold loader_mutex_
+   */
+  void publishSnapshot(const std::shared_ptr<Snapshot> & snapshot);
+
+  /**
+   * @struct NewClassLoader
+   * @brief A ClassLoader created for a library which is not bound yet
+   */
+  struct NewClassLoader
+  {
+    ClassLoader * loader;
+    // Indicates if classes holds the classes of the library, see findClassesToIndex()
+    bool indexed;
+    std::vector<std::pair<std::string, std::string>> classes;
+  };
+
+  /**
+   * @brief Binds several ClassLoaders to their libraries and indexes their classes at once
+   * A ClassLoader whose library had another ClassLoader bound to it in the meantime is destroyed.
+   * @param new_loaders - the ClassLoaders to bind, entries with a nullptr loader are skipped
+   */
+  void addClassLoaders(const std::vector<NewClassLoader> & new_loaders);
+
+  /**
+   * @brief Unbinds a ClassLoader from its library, it is destroyed by the caller
+   */
+  void removeClassLoader(ClassLoader * loader);
+
+  /**
+   * @brief Unbinds several ClassLoaders from their libraries at once, they are destroyed by the caller
+   */
+  void removeClassLoaders(const ClassLoaderVector & loaders);
+
   /**
    * @brief Destroys all ClassLoaders
    */
@@ -354,8 +729,23 @@ private:
 
 private:
   bool enable_ondemand_loadunload_;
+  unsigned int load_flags_;
+  // Note: Changes to the bound libraries are serialized by loader_mutex_
   LibraryToClassLoaderMap active_class_loaders_;
   boost::mutex loader_mutex_;
+  // Only accessed through std::atomic_load() and std::atomic_store()
+  std::shared_ptr<const Snapshot> snapshot_;
+
+  struct LibraryResidency
+  {
+    std::size_t mapped_size;
+    std::uint64_t last_use;
+  };
+  // Residency budget and use of each library; guarded by loader_mutex_ except for the budget
+  std::atomic<std::size_t> residency_budget_;
+  std::size_t residency_evictions_;
+  std::uint64_t residency_clock_;
+  std::map<ClassLoader *, LibraryResidency> residency_;
 };
 
 
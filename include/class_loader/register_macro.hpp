@@ -69,4 +69,64 @@
 #define CLASS_LOADER_REGISTER_CLASS(Derived, Base) \
   CLASS_LOADER_REGISTER_CLASS_WITH_MESSAGE(Derived, Base, "")
 
+#define CLASS_LOADER_REGISTER_CLASS_WITH_ARGS_INTERNAL(Derived, Base, UniqueID, ...) \
+  namespace \
+  { \
+  struct ProxyExec ## UniqueID \
+  { \
+    typedef  Derived _derived; \
+    typedef  Base _base; \
+    ProxyExec ## UniqueID() \
+    { \
+      class_loader::impl::registerPlugin<_derived, _base, __VA_ARGS__>(#Derived, #Base); \
+    } \
+  }; \
+  static ProxyExec ## UniqueID g_register_plugin_ ## UniqueID; \
+  }  // namespace
+
+#define CLASS_LOADER_REGISTER_CLASS_WITH_ARGS_INTERNAL_HOP1(Derived, Base, UniqueID, ...) \
+  CLASS_LOADER_REGISTER_CLASS_WITH_ARGS_INTERNAL(Derived, Base, UniqueID, __VA_ARGS__)
+
+/**
+* @macro This macro is same as CLASS_LOADER_REGISTER_CLASS, but the class is constructed from arguments of the given types
+* rather than default constructed, e.g.
+*
+*   CLASS_LOADER_REGISTER_CLASS_WITH_ARGS(Derived, Base, std::size_t, std::string)
+*
+* Instances are created with ClassLoader::createUniqueInstance<Base>(class_name, args...), where the decayed types of the
+* arguments must match the registered ones exactly. The types must therefore not be references; pass a
+* std::reference_wrapper to construct from a reference.
+*/
+#define CLASS_LOADER_REGISTER_CLASS_WITH_ARGS(Derived, Base, ...) \
+  CLASS_LOADER_REGISTER_CLASS_WITH_ARGS_INTERNAL_HOP1(Derived, Base, __COUNTER__, __VA_ARGS__)
+
+/**
+* @macro The name of the symbol a library exports its class table under
+*/
+#define CLASS_LOADER_CLASS_TABLE_SYMBOL "class_loader_class_table"
+
+/**
+* @macro These macros are an alternative to CLASS_LOADER_REGISTER_CLASS that exports all classes of a library in a
+* single constant table, e.g.
+*
+*   CLASS_LOADER_BEGIN_CLASS_TABLE
+*   CLASS_LOADER_CLASS_TABLE_ENTRY(Derived1, Base)
+*   CLASS_LOADER_CLASS_TABLE_ENTRY(Derived2, Base)
+*   CLASS_LOADER_END_CLASS_TABLE
+*
+* The table is read by the ClassLoader right after opening the library, so no static initializer runs per class and
+* all factories are registered at once. It must be declared once per library, in one of its source (.cpp) files, and is
+* only seen when the library is opened through a ClassLoader.
+*/
+#define CLASS_LOADER_BEGIN_CLASS_TABLE \
+  extern "C" CLASS_LOADER_EXPORT const class_loader::impl::ClassTableEntry \
+  class_loader_class_table[]; \
+  const class_loader::impl::ClassTableEntry class_loader_class_table[] = {
+
+#define CLASS_LOADER_CLASS_TABLE_ENTRY(Derived, Base) \
+  {#Derived, #Base, &class_loader::impl::createTableMetaObject<Derived, Base>},
+
+#define CLASS_LOADER_END_CLASS_TABLE \
+  {nullptr, nullptr, nullptr}};
+
 #endif  // CLASS_LOADER__REGISTER_MACRO_HPP_
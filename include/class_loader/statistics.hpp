@@ -0,0 +1,208 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CLASS_LOADER__STATISTICS_HPP_
+#define CLASS_LOADER__STATISTICS_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "class_loader/meta_object.hpp"
+#include "class_loader/trace.hpp"
+#include "class_loader/visibility_control.hpp"
+
+/**
+ * @note Statistics are collected only while enabled, either through setStatisticsEnabled() or by
+ * setting the CLASS_LOADER_STATISTICS environment variable to 1. While disabled, the cost on the
+ * load and instantiation paths is a single check of a flag.
+ */
+
+namespace class_loader
+{
+namespace impl
+{
+
+/// Number of buckets in ClassStatistics::create_latency_histogram
+const std::size_t CREATE_LATENCY_BUCKETS = 32;
+
+/**
+ * @struct LibraryStatistics
+ * @brief Counters of a library, as collected while statistics were enabled
+ */
+struct LibraryStatistics
+{
+  std::string library_path;
+  /// Number of times the library was opened
+  uint64_t load_count;
+  /// Number of times the library was closed
+  uint64_t unload_count;
+  /// Number of times the library was opened again without registering new factories, and its factories were revived from the graveyard
+  uint64_t graveyard_revivals;
+  /// Total time spent opening the library, including static initialization
+  std::chrono::nanoseconds total_open_time;
+  /// Time spent opening the library the last time, including static initialization
+  std::chrono::nanoseconds last_open_time;
+  /// Time from the first to the last factory registration of the last open, i.e. the part of static initialization that registers plugins
+  std::chrono::nanoseconds last_static_init_time;
+};
+
+/**
+ * @struct ClassStatistics
+ * @brief Counters of a plugin class, as collected while statistics were enabled
+ */
+struct ClassStatistics
+{
+  std::string class_name;
+  std::string base_class_name;
+  /// The library the factory of the class was last registered by
+  std::string library_path;
+  /// Number of managed and unmanaged instances created
+  uint64_t create_count;
+  /// Number of instances not destroyed by their ClassLoader yet, which includes all unmanaged instances
+  uint64_t live_instances;
+  /// Total time spent in the constructor, including allocation
+  std::chrono::nanoseconds total_create_time;
+  /// Bucket i counts the instances whose creation took from 2^i to 2^(i+1) nanoseconds
+  std::array<uint64_t, CREATE_LATENCY_BUCKETS> create_latency_histogram;
+};
+
+/**
+ * @struct Statistics
+ * @brief A snapshot of the statistics of all libraries and classes
+ */
+struct Statistics
+{
+  bool enabled;
+  std::vector<LibraryStatistics> libraries;
+  std::vector<ClassStatistics> classes;
+};
+
+/**
+ * @brief Enables or disables collecting statistics. Counters already collected are kept.
+ */
+CLASS_LOADER_PUBLIC
+void setStatisticsEnabled(bool enabled);
+
+/**
+ * @brief Indicates if statistics are being collected
+ */
+CLASS_LOADER_PUBLIC
+bool isStatisticsEnabled();
+
+/**
+ * @brief Takes a snapshot of the statistics collected so far
+ */
+CLASS_LOADER_PUBLIC
+Statistics getStatistics();
+
+/**
+ * @brief Discards all statistics collected so far
+ */
+CLASS_LOADER_PUBLIC
+void resetStatistics();
+
+/**
+ * @brief Records that a library was opened
+ * @param library_path - The path+name of the library
+ * @param open_time - The time spent opening the library
+ * @param static_init_time - The time from the first to the last factory registration
+ */
+CLASS_LOADER_PUBLIC
+void recordLibraryOpened(
+  const std::string & library_path, std::chrono::nanoseconds open_time,
+  std::chrono::nanoseconds static_init_time);
+
+/**
+ * @brief Records that a library was closed, and forgets the types of the instances it created
+ * The types are forgotten even if statistics are disabled, so this is called regardless.
+ * @param library_path - The path+name of the library
+ */
+CLASS_LOADER_PUBLIC
+void recordLibraryClosed(const std::string & library_path);
+
+/**
+ * @brief Records that the factories of a library were revived from the graveyard
+ * @param library_path - The path+name of the library
+ */
+CLASS_LOADER_PUBLIC
+void recordGraveyardRevival(const std::string & library_path);
+
+/**
+ * @brief Records that an instance was created
+ * @param factory - The factory that created the instance
+ * @param type - The dynamic type of the instance
+ * @param create_time - The time spent creating the instance
+ */
+CLASS_LOADER_PUBLIC
+void recordInstanceCreated(
+  AbstractMetaObjectBase * factory, const std::type_info & type,
+  std::chrono::nanoseconds create_time);
+
+/**
+ * @brief Records that a managed instance was destroyed
+ * @param type - The dynamic type of the instance
+ */
+CLASS_LOADER_PUBLIC
+void recordInstanceDestroyed(const std::type_info & type);
+
+/**
+ * @brief Creates an instance through a factory, recording it if statistics or tracing are enabled
+ * @param factory - The factory that creates the instance
+ * @param create - A callable creating the instance through the factory
+ * @return The newly created instance
+ */
+template<class Base, typename CreateFunction>
+Base * createAndRecordInstance(AbstractMetaObjectBase * factory, CreateFunction create)
+{
+  if (!isStatisticsEnabled() && !isTraceEnabled()) {
+    return create();
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Base * obj = create();
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  if (isStatisticsEnabled()) {
+    recordInstanceCreated(factory, typeid(*obj), end - start);
+  }
+  if (isTraceEnabled()) {
+    recordInstanceTraced(factory, start, end);
+  }
+  return obj;
+}
+
+}  // namespace impl
+}  // namespace class_loader
+
+#endif  // CLASS_LOADER__STATISTICS_HPP_
@@ -0,0 +1,136 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CLASS_LOADER__TRACE_HPP_
+#define CLASS_LOADER__TRACE_HPP_
+
+#include <chrono>
+#include <string>
+
+#include "class_loader/meta_object.hpp"
+#include "class_loader/visibility_control.hpp"
+
+/**
+ * @note Trace events are written only while a trace file is set, either through setTraceFile() or
+ * through the CLASS_LOADER_TRACE_FILE environment variable. The file uses the JSON array format of
+ * the Chrome trace viewer, which chrome://tracing and the Perfetto UI open directly. Events are
+ * written as they complete, so the trace of a process that crashed is readable as well. While
+ * tracing is disabled, the cost on the load and instantiation paths is a single check of a flag.
+ */
+
+namespace class_loader
+{
+namespace impl
+{
+
+/**
+ * @brief Starts writing trace events to a file, or stops tracing
+ * @param trace_file - The path of the file to write, which is truncated; empty to stop tracing
+ * @return true if the trace file could be opened or tracing was stopped, false otherwise
+ */
+CLASS_LOADER_PUBLIC
+bool setTraceFile(const std::string & trace_file);
+
+/**
+ * @brief Indicates if trace events are being written
+ */
+CLASS_LOADER_PUBLIC
+bool isTraceEnabled();
+
+/**
+ * @brief Flushes the trace events written so far to the trace file
+ */
+CLASS_LOADER_PUBLIC
+void flushTrace();
+
+/**
+ * @brief Writes an event that spans a period of time to the trace file
+ * @param name - The name of the event
+ * @param detail - A string describing the subject of the event, e.g. a library or class name
+ * @param start - When the event started
+ * @param end - When the event ended
+ */
+CLASS_LOADER_PUBLIC
+void recordTraceEvent(
+  const char * name, const char * detail, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end);
+
+/**
+ * @brief Writes a createInstance event if this is the first instance created through a factory
+ * @param factory - The factory that created the instance
+ * @param start - When the creation started
+ * @param end - When the creation ended
+ */
+CLASS_LOADER_PUBLIC
+void recordInstanceTraced(
+  AbstractMetaObjectBase * factory, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end);
+
+/**
+ * @class ScopedTraceEvent
+ * @brief Writes an event spanning its lifetime to the trace file, if tracing was enabled on construction
+ */
+class ScopedTraceEvent
+{
+public:
+  /**
+   * @param name - The name of the event, which must outlive this object
+   * @param detail - The subject of the event, which must outlive this object
+   */
+  ScopedTraceEvent(const char * name, const char * detail)
+  : name_(name), detail_(detail), enabled_(isTraceEnabled())
+  {
+    if (enabled_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedTraceEvent()
+  {
+    if (enabled_) {
+      recordTraceEvent(name_, detail_, start_, std::chrono::steady_clock::now());
+    }
+  }
+
+  ScopedTraceEvent(const ScopedTraceEvent &) = delete;
+  ScopedTraceEvent & operator=(const ScopedTraceEvent &) = delete;
+
+private:
+  const char * name_;
+  const char * detail_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace impl
+}  // namespace class_loader
+
+#endif  // CLASS_LOADER__TRACE_HPP_
@@ -29,13 +29,136 @@
 
 #include "class_loader/class_loader.hpp"
 
+#include <boost/align/aligned_alloc.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <future>
+#include <limits>
+#include <list>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "Poco/SharedLibrary.h"
 
 namespace class_loader
 {
 
+namespace impl
+{
+
+/**
+ * @class IdleUnloadReaper
+ * @brief Background thread unloading the libraries of on-demand ClassLoaders which stayed unused for their unload delay
+ */
+class IdleUnloadReaper
+{
+public:
+  static IdleUnloadReaper & instance()
+  {
+    // Leaked on purpose, ClassLoaders may still be destroyed during static destruction
+    static IdleUnloadReaper * reaper = new IdleUnloadReaper();
+    return *reaper;
+  }
+
+  void schedule(ClassLoader * loader, std::chrono::steady_clock::time_point deadline)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    eraseLoader(loader);
+    // Most recently idle at the back
+    idle_.push_back(IdleLibrary{loader, deadline});
+    if (!started_) {
+      std::thread(&IdleUnloadReaper::run, this).detach();
+      started_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  void cancel(ClassLoader * loader, bool wait_for_unload)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    eraseLoader(loader);
+    if (wait_for_unload) {
+      condition_.wait(lock, [this, loader]() {return unloading_ != loader;});
+    }
+  }
+
+  void setMaxIdleLibraries(std::size_t max_idle_libraries)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_idle_libraries_ = max_idle_libraries;
+    condition_.notify_all();
+  }
+
+private:
+  struct IdleLibrary
+  {
+    ClassLoader * loader;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  IdleUnloadReaper()
+  : max_idle_libraries_(std::numeric_limits<std::size_t>::max()),
+    unloading_(nullptr),
+    started_(false)
+  {}
+
+  void eraseLoader(ClassLoader * loader)
+  {
+    idle_.remove_if([loader](const IdleLibrary & idle) {return idle.loader == loader;});
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;; ) {
+      auto victim = idle_.end();
+      if (idle_.size() > max_idle_libraries_) {
+        victim = idle_.begin();
+      } else {
+        victim = std::min_element(
+          idle_.begin(), idle_.end(), [](const IdleLibrary & a, const IdleLibrary & b) {
+            return a.deadline < b.deadline;
+          });
+        if (victim != idle_.end() && victim->deadline > std::chrono::steady_clock::now()) {
+          condition_.wait_until(lock, victim->deadline);
+          continue;
+        }
+      }
+      if (victim == idle_.end()) {
+        condition_.wait(lock);
+        continue;
+      }
+
+      // The loader cannot be destroyed while it is unloading_, see cancel()
+      unloading_ = victim->loader;
+      idle_.erase(victim);
+      lock.unlock();
+      try {
+        unloading_->unloadIdleLibrary();
+      } catch (const class_loader::LibraryUnloadException & e) {
+        CONSOLE_BRIDGE_logWarn(
+          "class_loader.IdleUnloadReaper: Failed to unload idle library: %s", e.what());
+      }
+      lock.lock();
+      unloading_ = nullptr;
+      condition_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::list<IdleLibrary> idle_;
+  std::size_t max_idle_libraries_;
+  ClassLoader * unloading_;
+  bool started_;
+};
+
+}  // namespace impl
+
 bool ClassLoader::has_unmananged_instance_been_created_ = false;
 
 bool ClassLoader::hasUnmanagedInstanceBeenCreated()
@@ -62,51 +185,405 @@ std::string systemLibraryFormat(const std::string & library_name)
   return systemLibraryPrefix() + library_name + systemLibrarySuffix();
 }
 
-ClassLoader::ClassLoader(const std::string & library_path, bool ondemand_load_unload)
+ClassLoader::ClassLoader(
+  const std::string & library_path, bool ondemand_load_unload, unsigned int load_flags)
 : ondemand_load_unload_(ondemand_load_unload),
+  load_flags_(load_flags),
   library_path_(library_path),
   load_ref_count_(0),
-  plugin_ref_count_(0)
+  plugin_ref_count_(0),
+  library_generation_(0),
+  unload_delay_(0),
+  unload_pending_(false),
+  prefetch_pending_(false),
+  unpooled_instances_(this),
+  instance_pools_(nullptr),
+  retired_(false),
+  unmanaged_instance_created_(false),
+  reloaded_version_(nullptr)
 {
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.ClassLoader: "
     "Constructing new ClassLoader (%p) bound to library %s.",
     this, library_path.c_str());
   if (!isOnDemandLoadUnloadEnabled()) {
-    loadLibrary();
+    loadLibraryInternal();
   }
 }
 
 ClassLoader::~ClassLoader()
 {
-  CONSOLE_BRIDGE_logDebug("%s",
+  CLASS_LOADER_LOG_DEBUG("%s",
     "class_loader.ClassLoader: "
     "Destroying class loader, unloading associated library...\n");
-  unloadLibrary();  // TODO(mikaelarguedas): while(unloadLibrary() > 0){} ??
+  for (auto & version : reloaded_versions_) {
+    std::string version_path = version->getLibraryPath();
+    delete version;
+    class_loader::impl::removeLibraryVersion(version_path);
+  }
+  waitForPrefetchInternal();
+  {
+    boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+    unload_pending_ = false;
+  }
+  impl::IdleUnloadReaper::instance().cancel(this, true);
+  unloadLibraryInternal(true);  // TODO(mikaelarguedas): while(unloadLibrary() > 0){} ??
+  drainPooledStorage();
 }
 
 bool ClassLoader::isLibraryLoaded()
 {
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->isLibraryLoaded();
+  }
   return class_loader::impl::isLibraryLoaded(getLibraryPath(), this);
 }
 
 bool ClassLoader::isLibraryLoadedByAnyClassloader()
 {
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->isLibraryLoadedByAnyClassloader();
+  }
   return class_loader::impl::isLibraryLoadedByAnybody(getLibraryPath());
 }
 
 void ClassLoader::loadLibrary()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->loadLibrary();
+  }
+  loadLibraryInternal();
+}
+
+void ClassLoader::loadLibraryInternal()
 {
   boost::recursive_mutex::scoped_lock lock(load_ref_count_mutex_);
-  load_ref_count_ = load_ref_count_ + 1;
+  // Only count successful loads, a failed one must not be unloaded later
   class_loader::impl::loadLibrary(getLibraryPath(), this);
+  load_ref_count_ = load_ref_count_ + 1;
+}
+
+void ClassLoader::acquirePluginReferences(int count)
+{
+  int plugin_ref_count = plugin_ref_count_;
+  while (plugin_ref_count > 0) {
+    if (plugin_ref_count_.compare_exchange_weak(plugin_ref_count, plugin_ref_count + count)) {
+      return;
+    }
+  }
+  // Wait for a concurrent unload to complete
+  boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+  plugin_ref_count_ += count;
+}
+
+void ClassLoader::releasePluginReference()
+{
+  releasePluginReferences(1);
+}
+
+void ClassLoader::releasePluginReferences(int count)
+{
+  int plugin_ref_count = plugin_ref_count_;
+  while (plugin_ref_count > count) {
+    if (plugin_ref_count_.compare_exchange_weak(plugin_ref_count, plugin_ref_count - count)) {
+      return;
+    }
+  }
+
+  bool unload = false;
+  bool retired = false;
+  {
+    boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+    plugin_ref_count = plugin_ref_count_ -= count;
+    assert(plugin_ref_count >= 0);
+    if (0 == plugin_ref_count && (isOnDemandLoadUnloadEnabled() || retired_)) {
+      if (ClassLoader::hasUnmanagedInstanceBeenCreated()) {
+        CONSOLE_BRIDGE_logWarn(
+          "class_loader::ClassLoader: "
+          "Cannot unload library %s even though last shared pointer went out of scope. "
+          "This is because createUnmanagedInstance was used within the scope of this process,"
+          " perhaps by a different ClassLoader. Library will NOT be closed.",
+          getLibraryPath().c_str());
+      } else if (retired_) {
+        unload = true;
+        retired = true;
+      } else if (unload_delay_.count() > 0) {
+        unload_pending_ = true;
+        impl::IdleUnloadReaper::instance().schedule(
+          this, std::chrono::steady_clock::now() + unload_delay_);
+      } else {
+        // Cancelled by ensureLibraryLoaded() if a plugin is created in the meantime
+        unload_pending_ = true;
+        unload = true;
+      }
+    }
+  }
+  // Note: Unloading takes load_ref_count_mutex_ before plugin_ref_count_mutex_, so it must not
+  // be entered with plugin_ref_count_mutex_ held; both unloads check the count again
+  if (unload && retired) {
+    unloadRetiredLibrary();
+  } else if (unload) {
+    unloadIdleLibrary();
+  }
+}
+
+void ClassLoader::ensureLibraryLoaded()
+{
+  waitForPrefetchInternal();
+  if (unload_pending_) {
+    boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+    if (unload_pending_) {
+      unload_pending_ = false;
+      impl::IdleUnloadReaper::instance().cancel(this, false);
+    }
+  }
+  // A loaded library stays loaded as long as it is referenced by load_ref_count_
+  if (0 == load_ref_count_) {
+    boost::recursive_mutex::scoped_lock lock(load_ref_count_mutex_);
+    if (0 == load_ref_count_) {
+      loadLibraryInternal();
+    }
+  }
+}
+
+void ClassLoader::acquireLoadedLibrary(int count)
+{
+  acquirePluginReferences(count);
+  try {
+    ensureLibraryLoaded();
+  } catch (...) {
+    releasePluginReferences(count);
+    throw;
+  }
+}
+
+bool ClassLoader::unloadIdleLibrary()
+{
+  boost::recursive_mutex::scoped_lock load_ref_lock(load_ref_count_mutex_);
+  boost::recursive_mutex::scoped_lock plugin_ref_lock(plugin_ref_count_mutex_);
+  // Creators take their plugin reference before they make sure the library is loaded
+  bool unloaded = false;
+  if (unload_pending_ && 0 == plugin_ref_count_ && load_ref_count_ > 0) {
+    unloaded = 0 == unloadLibraryInternal(false);
+  }
+  unload_pending_ = false;
+  return unloaded;
+}
+
+bool ClassLoader::evictLibrary()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->evictLibrary();
+  }
+  {
+    boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+    if (0 != plugin_ref_count_ || isLibraryPinned()) {
+      return false;
+    }
+    // Cancelled by ensureLibraryLoaded() if a plugin is created in the meantime
+    unload_pending_ = true;
+  }
+  return unloadIdleLibrary();
+}
+
+bool ClassLoader::isLibraryPinned()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->isLibraryPinned();
+  }
+  return unmanaged_instance_created_ || class_loader::impl::hasANonPurePluginLibraryBeenOpened();
+}
+
+int ClassLoader::getInstanceCount()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->getInstanceCount();
+  }
+  return plugin_ref_count_;
+}
+
+void ClassLoader::setUnloadDelay(std::chrono::milliseconds delay)
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->setUnloadDelay(delay);
+  }
+  boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+  unload_delay_ = delay;
+}
+
+std::chrono::milliseconds ClassLoader::getUnloadDelay()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->getUnloadDelay();
+  }
+  boost::recursive_mutex::scoped_lock lock(plugin_ref_count_mutex_);
+  return unload_delay_;
+}
+
+void ClassLoader::setMaxIdleLibraries(std::size_t max_idle_libraries)
+{
+  impl::IdleUnloadReaper::instance().setMaxIdleLibraries(max_idle_libraries);
+}
+
+ClassLoader::InstancePool & ClassLoader::getInstancePool(
+  const impl::AbstractMetaObjectBase * meta_object)
+{
+  for (InstancePool * pool = instance_pools_; nullptr != pool; pool = pool->next) {
+    if (pool->meta_object == meta_object) {
+      return *pool;
+    }
+  }
+  boost::mutex::scoped_lock lock(instance_pools_mutex_);
+  for (InstancePool * pool = instance_pools_; nullptr != pool; pool = pool->next) {
+    if (pool->meta_object == meta_object) {
+      return *pool;
+    }
+  }
+  InstancePool * pool = new InstancePool(this, meta_object);
+  pool->next = instance_pools_;
+  instance_pools_ = pool;
+  return *pool;
+}
+
+void ClassLoader::drainPooledStorage()
+{
+  boost::mutex::scoped_lock lock(instance_pools_mutex_);
+  InstancePool * pool = instance_pools_.exchange(nullptr);
+  while (nullptr != pool) {
+    for (auto & storage : pool->storage) {
+      boost::alignment::aligned_free(storage);
+    }
+    InstancePool * next = pool->next;
+    delete pool;
+    pool = next;
+  }
+}
+
+std::shared_future<void> ClassLoader::prefetch()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->prefetch();
+  }
+  boost::recursive_mutex::scoped_lock lock(load_ref_count_mutex_);
+  if (prefetch_.valid() &&
+    prefetch_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    return prefetch_;
+  }
+  if (isLibraryLoaded()) {
+    std::promise<void> loaded;
+    loaded.set_value();
+    return loaded.get_future().share();
+  }
+  prefetch_ = std::async(
+    std::launch::async, [this]() {
+      class_loader::impl::prefetchLibrary(
+        getLibraryPath(), 0 != (load_flags_ & LIBRARY_PREFETCH_DEPENDENCIES));
+      loadLibraryInternal();
+    }).share();
+  prefetch_pending_ = true;
+  return prefetch_;
+}
+
+void ClassLoader::waitForPrefetch()
+{
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->waitForPrefetch();
+  }
+  waitForPrefetchInternal();
+}
+
+void ClassLoader::waitForPrefetchInternal()
+{
+  if (!prefetch_pending_) {
+    return;
+  }
+  std::shared_future<void> prefetch;
+  {
+    boost::recursive_mutex::scoped_lock lock(load_ref_count_mutex_);
+    prefetch = prefetch_;
+  }
+  if (prefetch.valid()) {
+    prefetch.wait();
+  }
+  // The outcome has been handed out by prefetch(), so a completed load is forgotten
+  boost::recursive_mutex::scoped_lock lock(load_ref_count_mutex_);
+  if (prefetch_.valid() &&
+    prefetch_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    prefetch_ = std::shared_future<void>();
+    prefetch_pending_ = false;
+  }
 }
 
 int ClassLoader::unloadLibrary()
 {
+  if (ClassLoader * version = getReloadedVersion()) {
+    return version->unloadLibrary();
+  }
   return unloadLibraryInternal(true);
 }
 
+void ClassLoader::reloadLibrary()
+{
+  boost::recursive_mutex::scoped_lock lock(reload_mutex_);
+  ClassLoader * previous = nullptr != getReloadedVersion() ? getReloadedVersion() : this;
+
+  // Loading the copy shadows the factories of the previous version for this ClassLoader
+  std::string version_path = class_loader::impl::createLibraryVersion(getLibraryPath());
+  ClassLoader * version = nullptr;
+  try {
+    version = new ClassLoader(version_path, isOnDemandLoadUnloadEnabled(), load_flags_);
+    if (version->isOnDemandLoadUnloadEnabled()) {
+      version->loadLibraryInternal();
+    }
+    if (!class_loader::impl::areFactoriesOfLibrary(version_path)) {
+      throw class_loader::LibraryLoadException(
+              "Could not reload library " + getLibraryPath() + " as the factories of the new "
+              "version resolve to the version in use. Load it with LIBRARY_LOAD_LOCAL or hide "
+              "its symbols to reload it.");
+    }
+  } catch (...) {
+    delete version;
+    class_loader::impl::removeLibraryVersion(version_path);
+    throw;
+  }
+  version->setUnloadDelay(previous->getUnloadDelay());
+  CLASS_LOADER_LOG_DEBUG(
+    "class_loader.ClassLoader: Reloaded library %s from %s.",
+    getLibraryPath().c_str(), version_path.c_str());
+
+  reloaded_versions_.push_back(version);
+  reloaded_version_ = version;
+  previous->retireLibrary();
+}
+
+void ClassLoader::retireLibrary()
+{
+  waitForPrefetchInternal();
+  // The reaper must not unload the library behind our back
+  impl::IdleUnloadReaper::instance().cancel(this, true);
+  boost::recursive_mutex::scoped_lock load_ref_lock(load_ref_count_mutex_);
+  boost::recursive_mutex::scoped_lock plugin_ref_lock(plugin_ref_count_mutex_);
+  retired_ = true;
+  unload_pending_ = false;
+  if (0 == plugin_ref_count_ && !ClassLoader::hasUnmanagedInstanceBeenCreated()) {
+    unloadRetiredLibrary();
+  }
+}
+
+void ClassLoader::unloadRetiredLibrary()
+{
+  CLASS_LOADER_LOG_DEBUG(
+    "class_loader.ClassLoader: Unloading library %s as a newer version is in use.",
+    getLibraryPath().c_str());
+  boost::recursive_mutex::scoped_lock load_ref_lock(load_ref_count_mutex_);
+  boost::recursive_mutex::scoped_lock plugin_ref_lock(plugin_ref_count_mutex_);
+  while (load_ref_count_ > 0 && 0 == plugin_ref_count_) {
+    unloadLibraryInternal(false);
+  }
+}
+
 int ClassLoader::unloadLibraryInternal(bool lock_plugin_ref_count)
 {
   boost::recursive_mutex::scoped_lock load_ref_lock(load_ref_count_mutex_);
@@ -124,6 +601,9 @@ int ClassLoader::unloadLibraryInternal(bool lock_plugin_ref_count)
   } else {
     load_ref_count_ = load_ref_count_ - 1;
     if (0 == load_ref_count_) {
+      ++library_generation_;
+      // The pool is keyed by factories that are about to be destroyed
+      drainPooledStorage();
       class_loader::impl::unloadLibrary(getLibraryPath(), this);
     } else if (load_ref_count_ < 0) {
       load_ref_count_ = 0;
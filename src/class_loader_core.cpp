@@ -32,9 +32,36 @@
 
 #include <Poco/SharedLibrary.h>
 
+#include <boost/thread/mutex.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace class_loader
@@ -42,6 +69,11 @@ namespace class_loader
 namespace impl
 {
 
+typedef std::map<LibraryPath, MetaObjectVector> LibraryToMetaObjectsMap;
+typedef std::map<LibraryPath, size_t> LibraryUsageMap;
+typedef std::map<const ClassLoader *, LibraryUsageMap> ClassLoaderToLibraryUsageMap;
+typedef std::unordered_map<LibraryPath, MetaObjectVector> LibraryToGraveyardMap;
+
 
 // Global data
 
@@ -51,9 +83,9 @@ boost::recursive_mutex & getLoadedLibraryVectorMutex()
   return m;
 }
 
-boost::recursive_mutex & getPluginBaseToFactoryMapMapMutex()
+boost::shared_mutex & getPluginBaseToFactoryMapMapMutex()
 {
-  static boost::recursive_mutex m;
+  static boost::shared_mutex m;
   return m;
 }
 
@@ -66,17 +98,20 @@ BaseToFactoryMapMap & getGlobalPluginBaseToFactoryMapMap()
 FactoryMap & getFactoryMapForBaseClass(const std::string & typeid_base_class_name)
 {
   BaseToFactoryMapMap & factoryMapMap = getGlobalPluginBaseToFactoryMapMap();
-  std::string base_class_name = typeid_base_class_name;
-  if (factoryMapMap.find(base_class_name) == factoryMapMap.end()) {
-    factoryMapMap[base_class_name] = FactoryMap();
-  }
+  return factoryMapMap[typeid_base_class_name];
+}
 
-  return factoryMapMap[base_class_name];
+const FactoryMap * findFactoryMapForBaseClass(const std::string & typeid_base_class_name)
+{
+  BaseToFactoryMapMap & factoryMapMap = getGlobalPluginBaseToFactoryMapMap();
+  BaseToFactoryMapMap::const_iterator itr = factoryMapMap.find(typeid_base_class_name);
+  return (itr == factoryMapMap.end()) ? nullptr : &itr->second;
 }
 
-MetaObjectVector & getMetaObjectGraveyard()
+// Note: The graveyard is bucketed by library, it is only ever searched for a single library
+LibraryToGraveyardMap & getMetaObjectGraveyard()
 {
-  static MetaObjectVector instance;
+  static LibraryToGraveyardMap instance;
   return instance;
 }
 
@@ -86,9 +121,42 @@ LibraryVector & getLoadedLibraryVector()
   return instance;
 }
 
+/**
+ * The position of each library in getLoadedLibraryVector(), so that it is not searched linearly.
+ * Protected by getLoadedLibraryVectorMutex().
+ */
+static std::unordered_map<LibraryPath, size_t> & getLoadedLibraryIndex()
+{
+  static std::unordered_map<LibraryPath, size_t> instance;
+  return instance;
+}
+
+// Note: The caller must hold getLoadedLibraryVectorMutex()
+static void addLoadedLibrary(const LibraryPair & library)
+{
+  LibraryVector & open_libraries = getLoadedLibraryVector();
+  getLoadedLibraryIndex()[library.first] = open_libraries.size();
+  open_libraries.push_back(library);
+}
+
+// Note: The caller must hold getLoadedLibraryVectorMutex(). Moves the last library into the gap.
+static void removeLoadedLibrary(LibraryVector::iterator itr)
+{
+  LibraryVector & open_libraries = getLoadedLibraryVector();
+  std::unordered_map<LibraryPath, size_t> & index = getLoadedLibraryIndex();
+  index.erase(itr->first);
+  if (itr + 1 != open_libraries.end()) {
+    *itr = open_libraries.back();
+    index[itr->first] = itr - open_libraries.begin();
+  }
+  open_libraries.pop_back();
+}
+
+// Note: The load context is thread local, so factories registering from the static initializers
+// of a library are attributed to the library and ClassLoader of the thread that opened it.
 std::string & getCurrentlyLoadingLibraryNameReference()
 {
-  static std::string library_name;
+  static thread_local std::string library_name;
   return library_name;
 }
 
@@ -105,7 +173,7 @@ void setCurrentlyLoadingLibraryName(const std::string & library_name)
 
 ClassLoader * & getCurrentlyActiveClassLoaderReference()
 {
-  static ClassLoader * loader = nullptr;
+  static thread_local ClassLoader * loader = nullptr;
   return loader;
 }
 
@@ -120,9 +188,91 @@ void setCurrentlyActiveClassLoader(ClassLoader * loader)
   loader_ref = loader;
 }
 
-bool & hasANonPurePluginLibraryBeenOpenedReference()
+/**
+ * Sets the load context of the calling thread for the lifetime of the object and restores the
+ * previous one afterwards, which is not empty if a library loads another one from its static
+ * initializers.
+ */
+class LoadContextGuard
+{
+public:
+  LoadContextGuard(const std::string & library_path, ClassLoader * loader)
+  : previous_library_path_(getCurrentlyLoadingLibraryName()),
+    previous_loader_(getCurrentlyActiveClassLoader())
+  {
+    setCurrentlyActiveClassLoader(loader);
+    setCurrentlyLoadingLibraryName(library_path);
+  }
+
+  ~LoadContextGuard()
+  {
+    setCurrentlyLoadingLibraryName(previous_library_path_);
+    setCurrentlyActiveClassLoader(previous_loader_);
+  }
+
+private:
+  std::string previous_library_path_;
+  ClassLoader * previous_loader_;
+};
+
+/**
+ * Locks the mutex serializing loads and unloads of a single library. Different libraries can be
+ * loaded concurrently. The mutex of a library only exists while somebody locks or waits for it.
+ */
+class LibraryLoadLock
+{
+public:
+  explicit LibraryLoadLock(const std::string & library_path)
+  {
+    {
+      boost::mutex::scoped_lock lock(getMapMutex());
+      // Note: Map nodes are stable, the entry lives until its last user is gone
+      library_mutex_ = &*getLibraryMutexes().emplace(
+        std::piecewise_construct, std::forward_as_tuple(library_path),
+        std::forward_as_tuple()).first;
+      ++library_mutex_->second.users;
+    }
+    library_mutex_->second.mutex.lock();
+  }
+
+  ~LibraryLoadLock()
+  {
+    library_mutex_->second.mutex.unlock();
+    boost::mutex::scoped_lock lock(getMapMutex());
+    if (0 == --library_mutex_->second.users) {
+      getLibraryMutexes().erase(library_mutex_->first);
+    }
+  }
+
+  LibraryLoadLock(const LibraryLoadLock &) = delete;
+  LibraryLoadLock & operator=(const LibraryLoadLock &) = delete;
+
+private:
+  struct LibraryMutex
+  {
+    boost::recursive_mutex mutex;
+    std::size_t users = 0;
+  };
+  typedef std::map<LibraryPath, LibraryMutex> LibraryMutexMap;
+
+  static boost::mutex & getMapMutex()
+  {
+    static boost::mutex map_mutex;
+    return map_mutex;
+  }
+
+  static LibraryMutexMap & getLibraryMutexes()
+  {
+    static LibraryMutexMap library_mutexes;
+    return library_mutexes;
+  }
+
+  LibraryMutexMap::value_type * library_mutex_;
+};
+
+std::atomic<bool> & hasANonPurePluginLibraryBeenOpenedReference()
 {
-  static bool hasANonPurePluginLibraryBeenOpenedReference = false;
+  static std::atomic<bool> hasANonPurePluginLibraryBeenOpenedReference(false);
   return hasANonPurePluginLibraryBeenOpenedReference;
 }
 
@@ -139,18 +289,358 @@ void hasANonPurePluginLibraryBeenOpened(bool hasIt)
 
 // MetaObject search/insert/removal/query
 
+// Note: The indices below only track metaobjects that are currently in a FactoryMap (i.e. not
+// the ones in the graveyard) and are protected by getPluginBaseToFactoryMapMapMutex().
+LibraryToMetaObjectsMap & getLibraryToMetaObjectsMap()
+{
+  static LibraryToMetaObjectsMap instance;
+  return instance;
+}
+
+ClassLoaderToLibraryUsageMap & getClassLoaderToLibraryUsageMap()
+{
+  static ClassLoaderToLibraryUsageMap instance;
+  return instance;
+}
+
+static std::atomic<uint64_t> & getRegistryGenerationCounter()
+{
+  static std::atomic<uint64_t> generation(0);
+  return generation;
+}
+
+/**
+ * Invalidates the factory lookups cached by all threads.
+ * Note: The caller must hold getPluginBaseToFactoryMapMapMutex() exclusively
+ */
+static void advanceRegistryGeneration()
+{
+  getRegistryGenerationCounter().fetch_add(1, std::memory_order_release);
+}
+
+uint64_t getRegistryGeneration()
+{
+  return getRegistryGenerationCounter().load(std::memory_order_acquire);
+}
+
+/// Number of factory lookups cached per thread
+const size_t FACTORY_LOOKUP_CACHE_SIZE = 8;
+
+struct FactoryLookupCacheEntry
+{
+  const std::type_info * interface;
+  std::string class_name;
+  const ClassLoader * loader;
+  FactoryLookup lookup;
+};
+
+/**
+ * The factory lookups of a thread, all made at the same registry generation. The entries are
+ * scanned linearly, which for a handful of classes is cheaper than hashing the class name.
+ */
+struct FactoryLookupCache
+{
+  uint64_t generation;
+  size_t size;
+  size_t next;
+  std::array<FactoryLookupCacheEntry, FACTORY_LOOKUP_CACHE_SIZE> entries;
+};
+
+static FactoryLookupCache & getFactoryLookupCache()
+{
+  static thread_local FactoryLookupCache cache = FactoryLookupCache();
+  return cache;
+}
+
+bool findCachedFactoryLookup(
+  const std::type_info & interface, const std::string & class_name, const ClassLoader * loader,
+  FactoryLookup & lookup)
+{
+  FactoryLookupCache & cache = getFactoryLookupCache();
+  if (cache.generation != getRegistryGeneration()) {
+    // Note: The type_info of an entry may be gone with its library, so do not even compare it
+    cache.size = 0;
+    return false;
+  }
+  for (size_t i = 0; i < cache.size; ++i) {
+    const FactoryLookupCacheEntry & entry = cache.entries[i];
+    if (entry.loader == loader && *entry.interface == interface && entry.class_name == class_name) {
+      lookup = entry.lookup;
+      return true;
+    }
+  }
+  return false;
+}
+
+void cacheFactoryLookup(
+  const std::type_info & interface, const std::string & class_name, const ClassLoader * loader,
+  const FactoryLookup & lookup, uint64_t generation)
+{
+  FactoryLookupCache & cache = getFactoryLookupCache();
+  if (cache.generation != generation) {
+    cache.generation = generation;
+    cache.size = 0;
+  }
+  size_t slot = cache.size;
+  if (cache.size < FACTORY_LOOKUP_CACHE_SIZE) {
+    ++cache.size;
+  } else {
+    slot = cache.next;
+    cache.next = (cache.next + 1) % FACTORY_LOOKUP_CACHE_SIZE;
+  }
+  FactoryLookupCacheEntry & entry = cache.entries[slot];
+  entry.interface = &interface;
+  entry.class_name = class_name;
+  entry.loader = loader;
+  entry.lookup = lookup;
+}
+
+void addMetaObjectToIndex(AbstractMetaObjectBase * meta_obj)
+{
+  getLibraryToMetaObjectsMap()[meta_obj->getAssociatedLibraryPath()].push_back(meta_obj);
+  ClassLoaderToLibraryUsageMap & usage = getClassLoaderToLibraryUsageMap();
+  for (auto & loader : meta_obj->getAssociatedClassLoaders()) {
+    ++usage[loader][meta_obj->getAssociatedLibraryPath()];
+  }
+}
+
+void decrementLibraryUsage(const ClassLoader * loader, const std::string & library_path)
+{
+  ClassLoaderToLibraryUsageMap & usage = getClassLoaderToLibraryUsageMap();
+  ClassLoaderToLibraryUsageMap::iterator loader_itr = usage.find(loader);
+  if (loader_itr == usage.end()) {
+    return;
+  }
+  LibraryUsageMap::iterator library_itr = loader_itr->second.find(library_path);
+  if (library_itr != loader_itr->second.end() && 0 == --library_itr->second) {
+    loader_itr->second.erase(library_itr);
+    if (loader_itr->second.empty()) {
+      usage.erase(loader_itr);
+    }
+  }
+}
+
+void removeMetaObjectFromIndex(AbstractMetaObjectBase * meta_obj)
+{
+  LibraryToMetaObjectsMap & library_map = getLibraryToMetaObjectsMap();
+  LibraryToMetaObjectsMap::iterator library_itr =
+    library_map.find(meta_obj->getAssociatedLibraryPath());
+  if (library_itr == library_map.end()) {
+    return;
+  }
+  MetaObjectVector & objs = library_itr->second;
+  MetaObjectVector::iterator obj_itr = std::find(objs.begin(), objs.end(), meta_obj);
+  if (obj_itr == objs.end()) {
+    return;
+  }
+  objs.erase(obj_itr);
+  if (objs.empty()) {
+    library_map.erase(library_itr);
+  }
+  for (auto & loader : meta_obj->getAssociatedClassLoaders()) {
+    decrementLibraryUsage(loader, meta_obj->getAssociatedLibraryPath());
+  }
+}
+
+void addMetaObjectOwner(AbstractMetaObjectBase * meta_obj, ClassLoader * loader)
+{
+  if (!meta_obj->isOwnedBy(loader)) {
+    advanceRegistryGeneration();
+    meta_obj->addOwningClassLoader(loader);
+    ++getClassLoaderToLibraryUsageMap()[loader][meta_obj->getAssociatedLibraryPath()];
+  }
+}
+
+void removeMetaObjectOwner(AbstractMetaObjectBase * meta_obj, const ClassLoader * loader)
+{
+  if (meta_obj->isOwnedBy(loader)) {
+    advanceRegistryGeneration();
+    meta_obj->removeOwningClassLoader(loader);
+    decrementLibraryUsage(loader, meta_obj->getAssociatedLibraryPath());
+  }
+}
+
+/**
+ * A copy of a library made by createLibraryVersion()
+ */
+struct LibraryVersion
+{
+  // The library the copy was made from
+  LibraryPath library_path;
+  // The file the copy is made from whenever it is opened
+  std::string library_file;
+};
+
+/**
+ * Maps the paths of the copies made by createLibraryVersion() to the library they were made from.
+ * Protected by getPluginBaseToFactoryMapMapMutex().
+ */
+std::unordered_map<LibraryPath, LibraryVersion> & getLibraryVersionMap()
+{
+  static std::unordered_map<LibraryPath, LibraryVersion> instance;
+  return instance;
+}
+
+/**
+ * Indicates if two metaobjects come from versions of the same library, which is expected rather
+ * than a namespace collision.
+ */
+bool areVersionsOfSameLibrary(AbstractMetaObjectBase * meta_obj, AbstractMetaObjectBase * other)
+{
+  std::unordered_map<LibraryPath, LibraryVersion> & versions = getLibraryVersionMap();
+  if (versions.empty()) {
+    return false;
+  }
+  std::unordered_map<LibraryPath, LibraryVersion>::const_iterator itr =
+    versions.find(meta_obj->getAssociatedLibraryPath());
+  std::unordered_map<LibraryPath, LibraryVersion>::const_iterator other_itr =
+    versions.find(other->getAssociatedLibraryPath());
+  if (itr == versions.end() && other_itr == versions.end()) {
+    return false;
+  }
+  return (itr != versions.end() ? itr->second.library_path : meta_obj->getAssociatedLibraryPath()) ==
+         (other_itr != versions.end() ?
+         other_itr->second.library_path : other->getAssociatedLibraryPath());
+}
+
+/**
+ * Inserts a metaobject into its FactoryMap, replacing (and unindexing) any previous
+ * metaobject registered under the same class name. A metaobject from another version of the
+ * same library is shadowed instead, it stays in use by the ClassLoaders that own it.
+ * @return true if another metaobject has been replaced by a namespace collision, otherwise false
+ */
+bool insertMetaObjectIntoFactoryMap(AbstractMetaObjectBase * meta_obj)
+{
+  assert(meta_obj->typeidBaseClassName() != "UNSET");
+  advanceRegistryGeneration();
+  FactoryMap & factory_map = getFactoryMapForBaseClass(meta_obj->typeidBaseClassName());
+  std::pair<FactoryMap::iterator, bool> result =
+    factory_map.insert(FactoryMap::value_type(meta_obj->className(), meta_obj));
+  bool replaced = false;
+  if (!result.second && result.first->second != meta_obj) {
+    if (areVersionsOfSameLibrary(meta_obj, result.first->second)) {
+      meta_obj->setShadowedVersion(result.first->second);
+    } else {
+      replaced = true;
+      removeMetaObjectFromIndex(result.first->second);
+    }
+    result.first->second = meta_obj;
+  } else if (!result.second) {
+    return false;
+  }
+  addMetaObjectToIndex(meta_obj);
+  return replaced;
+}
+
+/**
+ * Removes a metaobject from its FactoryMap, the version it shadows takes its place.
+ */
+void removeMetaObjectFromFactoryMap(AbstractMetaObjectBase * meta_obj)
+{
+  FactoryMap & factories = getFactoryMapForBaseClass(meta_obj->typeidBaseClassName());
+  FactoryMap::iterator factory_itr = factories.find(meta_obj->className());
+  if (factory_itr == factories.end()) {
+    return;
+  }
+  AbstractMetaObjectBase * shadowed = meta_obj->getShadowedVersion();
+  if (factory_itr->second == meta_obj) {
+    advanceRegistryGeneration();
+    meta_obj->setShadowedVersion(nullptr);
+    if (nullptr != shadowed) {
+      factory_itr->second = shadowed;
+    } else {
+      factories.erase(factory_itr);
+    }
+    return;
+  }
+  for (AbstractMetaObjectBase * newer = factory_itr->second; nullptr != newer;
+    newer = newer->getShadowedVersion())
+  {
+    if (newer->getShadowedVersion() == meta_obj) {
+      advanceRegistryGeneration();
+      meta_obj->setShadowedVersion(nullptr);
+      newer->setShadowedVersion(shadowed);
+      return;
+    }
+  }
+}
+
+/**
+ * The first and last time a factory was registered by the library being loaded on this thread,
+ * only maintained while statistics are enabled.
+ */
+static
+std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point> &
+getRegistrationTimes()
+{
+  static thread_local
+  std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point> times;
+  return times;
+}
+
+/**
+ * Registers the factories of a class table (@see ClassTableEntry) under a single lock.
+ */
+void registerClassTable(
+  const ClassTableEntry * table, const std::string & library_path, ClassLoader * loader)
+{
+  boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+  for (const ClassTableEntry * entry = table; nullptr != entry->class_name; ++entry) {
+    ScopedTraceEvent trace("registerClass", entry->class_name);
+    AbstractMetaObjectBase * meta_obj =
+      entry->create_meta_object(entry->class_name, entry->base_class_name);
+    meta_obj->addOwningClassLoader(loader);
+    meta_obj->setAssociatedLibraryPath(library_path);
+    if (insertMetaObjectIntoFactoryMap(meta_obj)) {
+      CONSOLE_BRIDGE_logWarn(
+        "class_loader.impl: SEVERE WARNING!!! "
+        "A namespace collision has occurred with plugin factory for class %s. "
+        "New factory from the class table of %s will OVERWRITE existing one.",
+        entry->class_name, library_path.c_str());
+    }
+  }
+}
+
+void registerMetaObject(AbstractMetaObjectBase * meta_obj)
+{
+  if (isStatisticsEnabled()) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (getRegistrationTimes().first == std::chrono::steady_clock::time_point()) {
+      getRegistrationTimes().first = now;
+    }
+    getRegistrationTimes().second = now;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+  if (insertMetaObjectIntoFactoryMap(meta_obj)) {
+    CONSOLE_BRIDGE_logWarn(
+      "class_loader.impl: SEVERE WARNING!!! "
+      "A namespace collision has occurred with plugin factory for class %s. "
+      "New factory will OVERWRITE existing one. "
+      "This situation occurs when libraries containing plugins are directly linked against an "
+      "executable (the one running right now generating this message). "
+      "Please separate plugins out into their own library or just don't link against the library "
+      "and use either class_loader::ClassLoader/MultiLibraryClassLoader to open.",
+      meta_obj->className().c_str());
+  }
+}
+
 MetaObjectVector allMetaObjects(const FactoryMap & factories)
 {
   MetaObjectVector all_meta_objs;
   for (auto & it : factories) {
-    all_meta_objs.push_back(it.second);
+    for (AbstractMetaObjectBase * meta_obj = it.second; nullptr != meta_obj;
+      meta_obj = meta_obj->getShadowedVersion())
+    {
+      all_meta_objs.push_back(meta_obj);
+    }
   }
   return all_meta_objs;
 }
 
 MetaObjectVector allMetaObjects()
 {
-  boost::recursive_mutex::scoped_lock lock(getPluginBaseToFactoryMapMapMutex());
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 
   MetaObjectVector all_meta_objs;
   BaseToFactoryMapMap & factory_map_map = getGlobalPluginBaseToFactoryMapMap();
@@ -163,127 +653,131 @@ MetaObjectVector allMetaObjects()
   return all_meta_objs;
 }
 
-MetaObjectVector
-filterAllMetaObjectsOwnedBy(const MetaObjectVector & to_filter, const ClassLoader * owner)
+// Note: The caller must hold a lock on getPluginBaseToFactoryMapMapMutex()
+bool isMetaObjectRegistered(const AbstractMetaObjectBase * meta_obj)
 {
-  MetaObjectVector filtered_objs;
-  for (auto & f : to_filter) {
-    if (f->isOwnedBy(owner)) {
-      filtered_objs.push_back(f);
-    }
+  const FactoryMap * factories = findFactoryMapForBaseClass(meta_obj->typeidBaseClassName());
+  if (nullptr == factories) {
+    return false;
   }
-  return filtered_objs;
-}
-
-MetaObjectVector
-filterAllMetaObjectsAssociatedWithLibrary(
-  const MetaObjectVector & to_filter, const std::string & library_path)
-{
-  MetaObjectVector filtered_objs;
-  for (auto & f : to_filter) {
-    if (f->getAssociatedLibraryPath() == library_path) {
-      filtered_objs.push_back(f);
+  FactoryMap::const_iterator itr = factories->find(meta_obj->className());
+  if (itr == factories->end()) {
+    return false;
+  }
+  for (const AbstractMetaObjectBase * version = itr->second; nullptr != version;
+    version = version->getShadowedVersion())
+  {
+    if (version == meta_obj) {
+      return true;
     }
   }
-  return filtered_objs;
+  return false;
 }
 
+// Note: The caller must hold a lock on getPluginBaseToFactoryMapMapMutex()
 MetaObjectVector
-allMetaObjectsForClassLoader(const ClassLoader * owner)
+allMetaObjectsForLibrary(const std::string & library_path)
 {
-  return filterAllMetaObjectsOwnedBy(allMetaObjects(), owner);
+  LibraryToMetaObjectsMap & library_map = getLibraryToMetaObjectsMap();
+  LibraryToMetaObjectsMap::iterator itr = library_map.find(library_path);
+  return (itr == library_map.end()) ? MetaObjectVector() : itr->second;
 }
 
-MetaObjectVector
-allMetaObjectsForLibrary(const std::string & library_path)
+size_t numMetaObjectsForLibrary(const std::string & library_path)
 {
-  return filterAllMetaObjectsAssociatedWithLibrary(allMetaObjects(), library_path);
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+
+  LibraryToMetaObjectsMap & library_map = getLibraryToMetaObjectsMap();
+  LibraryToMetaObjectsMap::iterator itr = library_map.find(library_path);
+  return (itr == library_map.end()) ? 0 : itr->second.size();
 }
 
-MetaObjectVector
-allMetaObjectsForLibraryOwnedBy(const std::string & library_path, const ClassLoader * owner)
+size_t
+numMetaObjectsForLibraryOwnedBy(const std::string & library_path, const ClassLoader * owner)
 {
-  return filterAllMetaObjectsOwnedBy(allMetaObjectsForLibrary(library_path), owner);
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+
+  ClassLoaderToLibraryUsageMap & usage = getClassLoaderToLibraryUsageMap();
+  ClassLoaderToLibraryUsageMap::iterator loader_itr = usage.find(owner);
+  if (loader_itr == usage.end()) {
+    return 0;
+  }
+  LibraryUsageMap::iterator library_itr = loader_itr->second.find(library_path);
+  return (library_itr == loader_itr->second.end()) ? 0 : library_itr->second;
 }
 
 void insertMetaObjectIntoGraveyard(AbstractMetaObjectBase * meta_obj)
 {
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Inserting MetaObject (class = %s, base_class = %s, ptr = %p) into graveyard",
     meta_obj->className().c_str(), meta_obj->baseClassName().c_str(),
     reinterpret_cast<void *>(meta_obj));
-  getMetaObjectGraveyard().push_back(meta_obj);
-}
-
-void destroyMetaObjectsForLibrary(
-  const std::string & library_path, FactoryMap & factories, const ClassLoader * loader)
-{
-  FactoryMap::iterator factory_itr = factories.begin();
-  while (factory_itr != factories.end()) {
-    AbstractMetaObjectBase * meta_obj = factory_itr->second;
-    if (meta_obj->getAssociatedLibraryPath() == library_path && meta_obj->isOwnedBy(loader)) {
-      meta_obj->removeOwningClassLoader(loader);
-      if (!meta_obj->isOwnedByAnybody()) {
-        FactoryMap::iterator factory_itr_copy = factory_itr;
-        factory_itr++;
-        // TODO(mikaelarguedas) fix this when branching out for melodic
-        // Note: map::erase does not return iterator like vector::erase does.
-        // Hence the ugliness of this code and a need for copy. Should be fixed in next C++ revision
-        factories.erase(factory_itr_copy);
-
-        // Insert into graveyard
-        // We remove the metaobject from its factory map, but we don't destroy it...instead it
-        // saved to a "graveyard" to the side.
-        // This is due to our static global variable initialization problem that causes factories
-        // to not be registered when a library is closed and then reopened.
-        // This is because it's truly not closed due to the use of global symbol binding i.e.
-        // calling dlopen with RTLD_GLOBAL instead of RTLD_LOCAL.
-        // We require using the former as the which is required to support RTTI
-        insertMetaObjectIntoGraveyard(meta_obj);
-      } else {
-        ++factory_itr;
-      }
-    } else {
-      ++factory_itr;
-    }
-  }
+  getMetaObjectGraveyard()[meta_obj->getAssociatedLibraryPath()].push_back(meta_obj);
 }
 
 void destroyMetaObjectsForLibrary(const std::string & library_path, const ClassLoader * loader)
 {
-  boost::recursive_mutex::scoped_lock lock(getPluginBaseToFactoryMapMapMutex());
+  boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Removing MetaObjects associated with library %s and class loader %p from global "
     "plugin-to-factorymap map.\n",
     library_path.c_str(), reinterpret_cast<const void *>(loader));
 
-  // We have to walk through all FactoryMaps to be sure
-  BaseToFactoryMapMap & factory_map_map = getGlobalPluginBaseToFactoryMapMap();
-  for (auto & it : factory_map_map) {
-    destroyMetaObjectsForLibrary(library_path, it.second, loader);
+  LibraryToMetaObjectsMap & library_map = getLibraryToMetaObjectsMap();
+  LibraryToMetaObjectsMap::iterator library_itr = library_map.find(library_path);
+  if (library_itr == library_map.end()) {
+    return;
+  }
+
+  // Compacts the index of the library in place instead of unindexing metaobjects one by one
+  MetaObjectVector & lib_meta_objs = library_itr->second;
+  size_t num_kept = 0;
+  for (size_t i = 0; i < lib_meta_objs.size(); ++i) {
+    AbstractMetaObjectBase * meta_obj = lib_meta_objs[i];
+    if (!meta_obj->isOwnedBy(loader)) {
+      lib_meta_objs[num_kept++] = meta_obj;
+      continue;
+    }
+    removeMetaObjectOwner(meta_obj, loader);
+    if (meta_obj->isOwnedByAnybody()) {
+      lib_meta_objs[num_kept++] = meta_obj;
+    } else {
+      removeMetaObjectFromFactoryMap(meta_obj);
+
+      // Insert into graveyard
+      // We remove the metaobject from its factory map, but we don't destroy it...instead it
+      // saved to a "graveyard" to the side.
+      // This is due to our static global variable initialization problem that causes factories
+      // to not be registered when a library is closed and then reopened.
+      // This is because it's truly not closed due to the use of global symbol binding i.e.
+      // calling dlopen with RTLD_GLOBAL instead of RTLD_LOCAL.
+      // We require using the former as the which is required to support RTTI
+      insertMetaObjectIntoGraveyard(meta_obj);
+    }
+  }
+  lib_meta_objs.resize(num_kept);
+  if (lib_meta_objs.empty()) {
+    library_map.erase(library_itr);
   }
 
-  CONSOLE_BRIDGE_logDebug("%s", "class_loader.impl: Metaobjects removed.");
+  CLASS_LOADER_LOG_DEBUG("%s", "class_loader.impl: Metaobjects removed.");
 }
 
 bool areThereAnyExistingMetaObjectsForLibrary(const std::string & library_path)
 {
-  return allMetaObjectsForLibrary(library_path).size() > 0;
+  return numMetaObjectsForLibrary(library_path) > 0;
 }
 
 // Loaded Library Vector manipulation
 LibraryVector::iterator findLoadedLibrary(const std::string & library_path)
 {
   LibraryVector & open_libraries = getLoadedLibraryVector();
-  for (auto it = open_libraries.begin(); it != open_libraries.end(); ++it) {
-    if (it->first == library_path) {
-      return it;
-    }
-  }
-  return open_libraries.end();
+  std::unordered_map<LibraryPath, size_t> & index = getLoadedLibraryIndex();
+  std::unordered_map<LibraryPath, size_t>::const_iterator itr = index.find(library_path);
+  return itr == index.end() ? open_libraries.end() : open_libraries.begin() + itr->second;
 }
 
 bool isLibraryLoadedByAnybody(const std::string & library_path)
@@ -304,9 +798,9 @@ bool isLibraryLoadedByAnybody(const std::string & library_path)
 bool isLibraryLoaded(const std::string & library_path, ClassLoader * loader)
 {
   bool is_lib_loaded_by_anyone = isLibraryLoadedByAnybody(library_path);
-  size_t num_meta_objs_for_lib = allMetaObjectsForLibrary(library_path).size();
+  size_t num_meta_objs_for_lib = numMetaObjectsForLibrary(library_path);
   size_t num_meta_objs_for_lib_bound_to_loader =
-    allMetaObjectsForLibraryOwnedBy(library_path, loader).size();
+    numMetaObjectsForLibraryOwnedBy(library_path, loader);
   bool are_meta_objs_bound_to_loader =
     (0 == num_meta_objs_for_lib) ? true : (
     num_meta_objs_for_lib_bound_to_loader <= num_meta_objs_for_lib);
@@ -316,18 +810,33 @@ bool isLibraryLoaded(const std::string & library_path, ClassLoader * loader)
 
 std::vector<std::string> getAllLibrariesUsedByClassLoader(const ClassLoader * loader)
 {
-  MetaObjectVector all_loader_meta_objs = allMetaObjectsForClassLoader(loader);
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+
   std::vector<std::string> all_libs;
-  for (auto & meta_obj : all_loader_meta_objs) {
-    std::string lib_path = meta_obj->getAssociatedLibraryPath();
-    if (std::find(all_libs.begin(), all_libs.end(), lib_path) == all_libs.end()) {
-      all_libs.push_back(lib_path);
+  ClassLoaderToLibraryUsageMap & usage = getClassLoaderToLibraryUsageMap();
+  ClassLoaderToLibraryUsageMap::iterator loader_itr = usage.find(loader);
+  if (loader_itr != usage.end()) {
+    for (auto & it : loader_itr->second) {
+      all_libs.push_back(it.first);
     }
   }
   return all_libs;
 }
 
 
+std::vector<std::pair<BaseClassName, ClassName>>
+getAllClassesForLibrary(const std::string & library_path)
+{
+  boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+
+  std::vector<std::pair<BaseClassName, ClassName>> classes;
+  for (auto & meta_obj : allMetaObjectsForLibrary(library_path)) {
+    classes.push_back(std::make_pair(meta_obj->typeidBaseClassName(), meta_obj->className()));
+  }
+  return classes;
+}
+
+
 // Implementation of Remaining Core plugin impl Functions
 
 void addClassLoaderOwnerForAllExistingMetaObjectsForLibrary(
@@ -335,109 +844,584 @@ void addClassLoaderOwnerForAllExistingMetaObjectsForLibrary(
 {
   MetaObjectVector all_meta_objs = allMetaObjectsForLibrary(library_path);
   for (auto & meta_obj : all_meta_objs) {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader.impl: "
       "Tagging existing MetaObject %p (base = %s, derived = %s) with "
       "class loader %p (library path = %s).",
       reinterpret_cast<void *>(meta_obj), meta_obj->baseClassName().c_str(),
       meta_obj->className().c_str(),
       reinterpret_cast<void *>(loader),
-      nullptr == loader ? loader->getLibraryPath().c_str() : "NULL");
-    meta_obj->addOwningClassLoader(loader);
+      nullptr != loader ? loader->getLibraryPath().c_str() : "NULL");
+    addMetaObjectOwner(meta_obj, loader);
   }
 }
 
 void revivePreviouslyCreateMetaobjectsFromGraveyard(
   const std::string & library_path, ClassLoader * loader)
 {
-  boost::recursive_mutex::scoped_lock b2fmm_lock(getPluginBaseToFactoryMapMapMutex());
-  MetaObjectVector & graveyard = getMetaObjectGraveyard();
+  ScopedTraceEvent trace("reviveGraveyard", library_path.c_str());
+  boost::unique_lock<boost::shared_mutex> b2fmm_lock(getPluginBaseToFactoryMapMapMutex());
+  LibraryToGraveyardMap & graveyard = getMetaObjectGraveyard();
+  LibraryToGraveyardMap::iterator bucket = graveyard.find(library_path);
+  if (bucket == graveyard.end()) {
+    return;
+  }
 
-  for (auto & obj : graveyard) {
-    if (obj->getAssociatedLibraryPath() == library_path) {
-      CONSOLE_BRIDGE_logDebug(
-        "class_loader.impl: "
-        "Resurrected factory metaobject from graveyard, class = %s, base_class = %s ptr = %p..."
-        "bound to ClassLoader %p (library path = %s)",
-        obj->className().c_str(), obj->baseClassName().c_str(), reinterpret_cast<void *>(obj),
-        reinterpret_cast<void *>(loader),
-        nullptr == loader ? loader->getLibraryPath().c_str() : "NULL");
+  for (auto & obj : bucket->second) {
+    CLASS_LOADER_LOG_DEBUG(
+      "class_loader.impl: "
+      "Resurrected factory metaobject from graveyard, class = %s, base_class = %s ptr = %p..."
+      "bound to ClassLoader %p (library path = %s)",
+      obj->className().c_str(), obj->baseClassName().c_str(), reinterpret_cast<void *>(obj),
+      reinterpret_cast<void *>(loader),
+      nullptr != loader ? loader->getLibraryPath().c_str() : "NULL");
 
-      obj->addOwningClassLoader(loader);
-      assert(obj->typeidBaseClassName() != "UNSET");
-      FactoryMap & factory = getFactoryMapForBaseClass(obj->typeidBaseClassName());
-      factory[obj->className()] = obj;
-    }
+    insertMetaObjectIntoFactoryMap(obj);
+    addMetaObjectOwner(obj, loader);
   }
 }
 
 void purgeGraveyardOfMetaobjects(
   const std::string & library_path, ClassLoader * loader, bool delete_objs)
 {
-  MetaObjectVector all_meta_objs = allMetaObjects();
-  // Note: Lock must happen after call to allMetaObjects as that will lock
-  boost::recursive_mutex::scoped_lock b2fmm_lock(getPluginBaseToFactoryMapMapMutex());
+  (void)loader;  // Only used in debug messages, which may be compiled out
+  ScopedTraceEvent trace("purgeGraveyard", library_path.c_str());
+  boost::unique_lock<boost::shared_mutex> b2fmm_lock(getPluginBaseToFactoryMapMapMutex());
+  LibraryToGraveyardMap & graveyard = getMetaObjectGraveyard();
+  LibraryToGraveyardMap::iterator bucket = graveyard.find(library_path);
+  if (bucket == graveyard.end()) {
+    return;
+  }
+  MetaObjectVector purged_objs;
+  purged_objs.swap(bucket->second);
+  graveyard.erase(bucket);
 
-  MetaObjectVector & graveyard = getMetaObjectGraveyard();
-  MetaObjectVector::iterator itr = graveyard.begin();
+  for (auto & obj : purged_objs) {
+    CLASS_LOADER_LOG_DEBUG(
+      "class_loader.impl: "
+      "Purging factory metaobject from graveyard, class = %s, base_class = %s ptr = %p.."
+      ".bound to ClassLoader %p (library path = %s)",
+      obj->className().c_str(), obj->baseClassName().c_str(), reinterpret_cast<void *>(obj),
+      reinterpret_cast<void *>(loader),
+      nullptr != loader ? loader->getLibraryPath().c_str() : "NULL");
 
-  while (itr != graveyard.end()) {
-    AbstractMetaObjectBase * obj = *itr;
-    if (obj->getAssociatedLibraryPath() == library_path) {
-      CONSOLE_BRIDGE_logDebug(
+    if (!delete_objs) {
+      continue;
+    }
+    if (isMetaObjectRegistered(obj)) {
+      CLASS_LOADER_LOG_DEBUG("%s",
         "class_loader.impl: "
-        "Purging factory metaobject from graveyard, class = %s, base_class = %s ptr = %p.."
-        ".bound to ClassLoader %p (library path = %s)",
-        obj->className().c_str(), obj->baseClassName().c_str(), reinterpret_cast<void *>(obj),
-        reinterpret_cast<void *>(loader),
-        nullptr == loader ? loader->getLibraryPath().c_str() : "NULL");
-
-      bool is_address_in_graveyard_same_as_global_factory_map =
-        std::find(all_meta_objs.begin(), all_meta_objs.end(), *itr) != all_meta_objs.end();
-      itr = graveyard.erase(itr);
-      if (delete_objs) {
-        if (is_address_in_graveyard_same_as_global_factory_map) {
-          CONSOLE_BRIDGE_logDebug("%s",
-            "class_loader.impl: "
-            "Newly created metaobject factory in global factory map map has same address as "
-            "one in graveyard -- metaobject has been purged from graveyard but not deleted.");
-        } else {
-          assert(hasANonPurePluginLibraryBeenOpened() == false);
-          CONSOLE_BRIDGE_logDebug(
-            "class_loader.impl: "
-            "Also destroying metaobject %p (class = %s, base_class = %s, library_path = %s) "
-            "in addition to purging it from graveyard.",
-            reinterpret_cast<void *>(obj), obj->className().c_str(), obj->baseClassName().c_str(),
-            obj->getAssociatedLibraryPath().c_str());
+        "Newly created metaobject factory in global factory map map has same address as "
+        "one in graveyard -- metaobject has been purged from graveyard but not deleted.");
+    } else {
+      assert(hasANonPurePluginLibraryBeenOpened() == false);
+      CLASS_LOADER_LOG_DEBUG(
+        "class_loader.impl: "
+        "Also destroying metaobject %p (class = %s, base_class = %s, library_path = %s) "
+        "in addition to purging it from graveyard.",
+        reinterpret_cast<void *>(obj), obj->className().c_str(), obj->baseClassName().c_str(),
+        obj->getAssociatedLibraryPath().c_str());
 #ifndef _WIN32
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdelete-non-virtual-dtor"
 #endif
-          delete (obj);  // Note: This is the only place where metaobjects can be destroyed
+      delete (obj);  // Note: This is the only place where metaobjects can be destroyed
 #ifndef _WIN32
 #pragma GCC diagnostic pop
 #endif
+    }
+  }
+}
+
+std::string findLibraryFile(const std::string & library_path)
+{
+#ifndef _WIN32
+  std::vector<std::string> candidates;
+  const char * search_path = getenv("LD_LIBRARY_PATH");
+  if (library_path.find('/') == std::string::npos && nullptr != search_path) {
+    std::string directories(search_path);
+    size_t begin = 0;
+    while (begin <= directories.size()) {
+      size_t end = directories.find(':', begin);
+      if (end == std::string::npos) {
+        end = directories.size();
+      }
+      if (end > begin) {
+        candidates.push_back(directories.substr(begin, end - begin) + "/" + library_path);
+      }
+      begin = end + 1;
+    }
+  }
+  candidates.push_back(library_path);
+
+  for (auto & candidate : candidates) {
+    if (0 == access(candidate.c_str(), R_OK)) {
+      return candidate;
+    }
+  }
+#else
+  (void)library_path;
+#endif
+  return std::string();
+}
+
+/**
+ * Finds the file a library was loaded from, so that a new version is copied from the same file.
+ * Falls back to the file of an earlier version, then to findLibraryFile() if the library is not
+ * loaded.
+ */
+static std::string findLibraryVersionSource(const std::string & library_path)
+{
+#ifdef __linux__
+  void * handle = dlopen(library_path.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+  if (nullptr != handle) {
+    struct link_map * library_map = nullptr;
+    std::string library_file;
+    if (0 == dlinfo(handle, RTLD_DI_LINKMAP, &library_map) && nullptr != library_map &&
+      nullptr != library_map->l_name)
+    {
+      library_file = library_map->l_name;
+    }
+    dlclose(handle);
+    if (!library_file.empty()) {
+      return library_file;
+    }
+  }
+#endif
+  {
+    boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+    for (auto & version : getLibraryVersionMap()) {
+      if (version.second.library_path == library_path) {
+        return version.second.library_file;
+      }
+    }
+  }
+  return findLibraryFile(library_path);
+}
+
+std::string createLibraryVersion(const std::string & library_path)
+{
+  std::string library_file = findLibraryVersionSource(library_path);
+  if (library_file.empty()) {
+    throw class_loader::LibraryLoadException(
+            "Could not find library " + library_path + " to reload it");
+  }
+#ifndef _WIN32
+  // A directory of its own keeps the copy out of the installation and away from other users
+  const char * temp_directory = getenv("TMPDIR");
+  std::string version_directory =
+    std::string(nullptr != temp_directory && '\0' != *temp_directory ? temp_directory : "/tmp") +
+    "/class_loader-XXXXXX";
+  if (nullptr == mkdtemp(&version_directory[0])) {
+    throw class_loader::LibraryLoadException(
+            "Could not create a directory for a copy of library " + library_file +
+            " to reload it: " + std::strerror(errno));
+  }
+  std::string version_path =
+    version_directory + "/" + library_file.substr(library_file.find_last_of('/') + 1);
+
+  boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+  getLibraryVersionMap()[version_path] = LibraryVersion{library_path, library_file};
+  return version_path;
+#else
+  throw class_loader::LibraryLoadException(
+          "Reloading library " + library_path + " is not supported on this platform");
+#endif
+}
+
+void removeLibraryVersion(const std::string & version_path)
+{
+  {
+    boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+    if (getLibraryVersionMap().erase(version_path) > 0) {
+      // The copy itself is only on disk while it is being opened, see LibraryVersionFile
+      std::remove(version_path.substr(0, version_path.find_last_of('/')).c_str());
+    }
+  }
+  // The copy is never opened again, so the factories it left in the graveyard can go
+  purgeGraveyardOfMetaobjects(version_path, nullptr, true);
+}
+
+/**
+ * Puts the copy of a library made by createLibraryVersion() on disk while it is being opened.
+ * Once the copy is mapped its file is unlinked again, so nothing is left behind even if the
+ * process does not exit cleanly. The copy is made again should the version be opened again.
+ */
+class LibraryVersionFile
+{
+public:
+  explicit LibraryVersionFile(const std::string & library_path)
+  {
+    std::string library_file;
+    {
+      boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+      std::unordered_map<LibraryPath, LibraryVersion>::const_iterator itr =
+        getLibraryVersionMap().find(library_path);
+      if (itr == getLibraryVersionMap().end()) {
+        return;
+      }
+      library_file = itr->second.library_file;
+    }
+
+    std::ifstream source(library_file, std::ios::binary);
+    std::ofstream copy(library_path, std::ios::binary | std::ios::trunc);
+    if (!source || !copy || !(copy << source.rdbuf()) || !copy.flush()) {
+      copy.close();
+      std::remove(library_path.c_str());
+      throw class_loader::LibraryLoadException(
+              "Could not copy library " + library_file + " to " + library_path + " to reload it");
+    }
+    version_path_ = library_path;
+  }
+
+  ~LibraryVersionFile()
+  {
+    if (!version_path_.empty()) {
+      std::remove(version_path_.c_str());
+    }
+  }
+
+  LibraryVersionFile(const LibraryVersionFile &) = delete;
+  LibraryVersionFile & operator=(const LibraryVersionFile &) = delete;
+
+private:
+  std::string version_path_;
+};
+
+#ifdef __linux__
+/**
+ * Splits a colon separated list of directories, substituting $ORIGIN with origin.
+ */
+static void appendSearchDirectories(
+  const std::string & directories, const std::string & origin, std::vector<std::string> & result)
+{
+  size_t begin = 0;
+  while (begin <= directories.size()) {
+    size_t end = directories.find(':', begin);
+    if (end == std::string::npos) {
+      end = directories.size();
+    }
+    std::string directory = directories.substr(begin, end - begin);
+    for (const char * token : {"$ORIGIN", "${ORIGIN}"}) {
+      size_t pos = directory.find(token);
+      if (pos != std::string::npos) {
+        directory.replace(pos, strlen(token), origin);
+      }
+    }
+    if (!directory.empty()) {
+      result.push_back(directory);
+    }
+    begin = end + 1;
+  }
+}
+
+/**
+ * Finds the files of the DT_NEEDED entries of a mapped ELF file which are not loaded in the
+ * process yet. The lookup follows the order of the dynamic loader, except that /etc/ld.so.cache
+ * is not consulted; dependencies that are only found through it are skipped.
+ */
+static void findNeededLibraries(
+  const std::string & library_file, const char * image, size_t size,
+  std::vector<std::string> & needed_files)
+{
+  const ElfW(Ehdr) * header = reinterpret_cast<const ElfW(Ehdr) *>(image);
+  if (size < sizeof(ElfW(Ehdr)) || 0 != memcmp(header->e_ident, ELFMAG, SELFMAG) ||
+    header->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+    header->e_phoff > size || header->e_phnum > (size - header->e_phoff) / sizeof(ElfW(Phdr)))
+  {
+    return;
+  }
+  const ElfW(Phdr) * segments = reinterpret_cast<const ElfW(Phdr) *>(image + header->e_phoff);
+  auto file_offset = [&](ElfW(Addr) address) -> size_t {
+      for (size_t i = 0; i < header->e_phnum; ++i) {
+        const ElfW(Phdr) & segment = segments[i];
+        if (PT_LOAD == segment.p_type && address >= segment.p_vaddr &&
+          address - segment.p_vaddr < segment.p_filesz)
+        {
+          return address - segment.p_vaddr + segment.p_offset;
         }
       }
-    } else {
-      itr++;
+      return size;
+    };
+
+  std::vector<size_t> needed;
+  size_t string_table = size, string_table_size = 0, run_path = 0, r_path = 0;
+  bool has_run_path = false, has_r_path = false;
+  for (size_t i = 0; i < header->e_phnum; ++i) {
+    if (PT_DYNAMIC != segments[i].p_type || segments[i].p_offset > size ||
+      segments[i].p_filesz > size - segments[i].p_offset)
+    {
+      continue;
+    }
+    const ElfW(Dyn) * entry = reinterpret_cast<const ElfW(Dyn) *>(image + segments[i].p_offset);
+    const ElfW(Dyn) * end = entry + segments[i].p_filesz / sizeof(ElfW(Dyn));
+    for (; entry < end && DT_NULL != entry->d_tag; ++entry) {
+      switch (entry->d_tag) {
+        case DT_NEEDED:
+          needed.push_back(entry->d_un.d_val);
+          break;
+        case DT_STRTAB:
+          string_table = file_offset(entry->d_un.d_ptr);
+          break;
+        case DT_STRSZ:
+          string_table_size = entry->d_un.d_val;
+          break;
+        case DT_RUNPATH:
+          run_path = entry->d_un.d_val;
+          has_run_path = true;
+          break;
+        case DT_RPATH:
+          r_path = entry->d_un.d_val;
+          has_r_path = true;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  if (string_table >= size || string_table_size > size - string_table) {
+    return;
+  }
+  auto get_string = [&](size_t offset) -> std::string {
+      if (offset >= string_table_size) {
+        return std::string();
+      }
+      const char * begin = image + string_table + offset;
+      return std::string(begin, strnlen(begin, string_table_size - offset));
+    };
+
+  std::string origin = library_file.substr(0, library_file.find_last_of('/') + 1);
+  if (origin.empty()) {
+    origin = ".";
+  }
+  std::vector<std::string> directories;
+  if (has_r_path && !has_run_path) {
+    appendSearchDirectories(get_string(r_path), origin, directories);
+  }
+  if (nullptr != getenv("LD_LIBRARY_PATH")) {
+    appendSearchDirectories(getenv("LD_LIBRARY_PATH"), origin, directories);
+  }
+  if (has_run_path) {
+    appendSearchDirectories(get_string(run_path), origin, directories);
+  }
+  for (const char * directory : {"/lib", "/usr/lib", "/lib64", "/usr/lib64"}) {
+    directories.push_back(directory);
+  }
+
+  for (size_t name_offset : needed) {
+    std::string name = get_string(name_offset);
+    void * handle = name.empty() ? nullptr : dlopen(name.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+    if (nullptr != handle) {
+      dlclose(handle);
+      continue;
+    }
+    if (name.find('/') != std::string::npos) {
+      needed_files.push_back(name);
+      continue;
+    }
+    for (auto & directory : directories) {
+      std::string candidate = directory + "/" + name;
+      if (0 == access(candidate.c_str(), R_OK)) {
+        needed_files.push_back(candidate);
+        break;
+      }
+    }
+  }
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * Maps a library file and faults all of its pages into the page cache.
+ * If needed_files is not null, the files of its dependencies that are not loaded yet are added.
+ */
+static bool prefetchLibraryFile(
+  const std::string & library_file, std::vector<std::string> * needed_files)
+{
+  int fd = open(library_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat library_stat;
+  void * image = MAP_FAILED;
+  if (0 == fstat(fd, &library_stat) && library_stat.st_size > 0) {
+    image = mmap(nullptr, library_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == image) {
+    return false;
+  }
+  size_t size = static_cast<size_t>(library_stat.st_size);
+  // Start the readahead of the whole file before blocking on its first page
+  madvise(image, size, MADV_WILLNEED);
+  // Actually touch every page, readahead hints alone are not reliable on network file systems
+  const volatile char * pages = static_cast<const volatile char *>(image);
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  for (size_t offset = 0; offset < size; offset += page_size) {
+    (void)pages[offset];
+  }
+#ifdef __linux__
+  if (nullptr != needed_files) {
+    findNeededLibraries(library_file, static_cast<const char *>(image), size, *needed_files);
+  }
+#else
+  (void)needed_files;
+#endif
+  munmap(image, size);
+  return true;
+}
+#endif
+
+bool prefetchLibrary(const std::string & library_path, bool prefetch_dependencies)
+{
+#ifndef _WIN32
+  ScopedTraceEvent trace("prefetchLibrary", library_path.c_str());
+  std::string library_file = findLibraryFile(library_path);
+  std::vector<std::string> needed_files;
+  if (library_file.empty() ||
+    !prefetchLibraryFile(library_file, prefetch_dependencies ? &needed_files : nullptr))
+  {
+    return false;
+  }
+  CLASS_LOADER_LOG_DEBUG(
+    "class_loader.impl: Prefetched library %s from %s.",
+    library_path.c_str(), library_file.c_str());
+
+  std::set<std::string> prefetched_files;
+  prefetched_files.insert(library_file);
+  while (!needed_files.empty()) {
+    std::string needed_file = needed_files.back();
+    needed_files.pop_back();
+    if (prefetched_files.insert(needed_file).second &&
+      prefetchLibraryFile(needed_file, &needed_files))
+    {
+      CLASS_LOADER_LOG_DEBUG(
+        "class_loader.impl: Prefetched dependency %s of library %s.",
+        needed_file.c_str(), library_path.c_str());
     }
   }
+  return true;
+#else
+  (void)library_path;
+  (void)prefetch_dependencies;
+  return false;
+#endif
+}
+
+#ifdef __linux__
+/**
+ * Gets the link map of a library that is already loaded, resolving its path the way dlopen() does.
+ * Returns nullptr if it is not loaded.
+ */
+static struct link_map * getLoadedLinkMap(const std::string & library_path)
+{
+  void * handle = dlopen(library_path.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+  if (nullptr == handle) {
+    return nullptr;
+  }
+  struct link_map * link_map = nullptr;
+  if (0 != dlinfo(handle, RTLD_DI_LINKMAP, &link_map)) {
+    link_map = nullptr;
+  }
+  // The library stays loaded through the handle it was opened with
+  dlclose(handle);
+  return link_map;
+}
+#endif
+
+/**
+ * Tells whether a symbol is defined by the library itself rather than by one of its dependencies,
+ * which the symbol lookup of a library handle searches as well.
+ */
+static bool isSymbolOfLibrary(const void * symbol, const std::string & library_path)
+{
+#ifdef __linux__
+  struct link_map * library_map = getLoadedLinkMap(library_path);
+  Dl_info symbol_info;
+  struct link_map * symbol_map = nullptr;
+  if (nullptr == library_map ||
+    0 == dladdr1(symbol, &symbol_info, reinterpret_cast<void **>(&symbol_map), RTLD_DL_LINKMAP))
+  {
+    return true;
+  }
+  return symbol_map == library_map;
+#else
+  (void)symbol;
+  (void)library_path;
+  return true;
+#endif
+}
+
+bool areFactoriesOfLibrary(const std::string & library_path)
+{
+  MetaObjectVector meta_objs;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+    meta_objs = allMetaObjectsForLibrary(library_path);
+  }
+  for (auto & meta_obj : meta_objs) {
+    // The type_info is found through the vtable the factory was constructed with, which is that
+    // of an earlier version if its symbols interpose those of the library
+    if (!isSymbolOfLibrary(&typeid(*meta_obj), library_path)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t getLibraryMappedSize(const std::string & library_path)
+{
+#ifdef __linux__
+  struct MappedLibrary
+  {
+    const struct link_map * link_map;
+    std::size_t size;
+  } mapped_library {getLoadedLinkMap(library_path), 0};
+  if (nullptr == mapped_library.link_map) {
+    return 0;
+  }
+
+  // The object the loader actually resolved, wherever it found it, is measured
+  dl_iterate_phdr(
+    [](struct dl_phdr_info * info, size_t, void * data) -> int {
+      MappedLibrary * mapped_library = static_cast<MappedLibrary *>(data);
+      if (info->dlpi_addr != mapped_library->link_map->l_addr ||
+      nullptr == info->dlpi_name || nullptr == mapped_library->link_map->l_name ||
+      0 != strcmp(info->dlpi_name, mapped_library->link_map->l_name))
+      {
+        return 0;
+      }
+      const ElfW(Addr) page_mask = static_cast<ElfW(Addr)>(sysconf(_SC_PAGESIZE)) - 1;
+      for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) & segment = info->dlpi_phdr[i];
+        if (PT_LOAD == segment.p_type) {
+          ElfW(Addr) begin = segment.p_vaddr & ~page_mask;
+          ElfW(Addr) end = (segment.p_vaddr + segment.p_memsz + page_mask) & ~page_mask;
+          mapped_library->size += end - begin;
+        }
+      }
+      return 1;
+    }, &mapped_library);
+  return mapped_library.size;
+#else
+  (void)library_path;
+  return 0;
+#endif
 }
 
 void loadLibrary(const std::string & library_path, ClassLoader * loader)
 {
-  static boost::recursive_mutex loader_mutex;
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Attempting to load library %s on behalf of ClassLoader handle %p...\n",
     library_path.c_str(), reinterpret_cast<void *>(loader));
-  boost::recursive_mutex::scoped_lock loader_lock(loader_mutex);
+  ScopedTraceEvent trace("loadLibrary", library_path.c_str());
+  LibraryLoadLock loader_lock(library_path);
 
   // If it's already open, just update existing metaobjects to have an additional owner.
   if (isLibraryLoadedByAnybody(library_path)) {
-    boost::recursive_mutex::scoped_lock lock(getPluginBaseToFactoryMapMapMutex());
-    CONSOLE_BRIDGE_logDebug("%s",
+    boost::unique_lock<boost::shared_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+    CLASS_LOADER_LOG_DEBUG("%s",
       "class_loader.impl: "
       "Library already in memory, but binding existing MetaObjects to loader if necesesary.\n");
     addClassLoaderOwnerForAllExistingMetaObjectsForLibrary(library_path, loader);
@@ -446,51 +1430,80 @@ void loadLibrary(const std::string & library_path, ClassLoader * loader)
 
   Poco::SharedLibrary * library_handle = nullptr;
 
+  std::chrono::steady_clock::time_point open_start = std::chrono::steady_clock::now();
+  getRegistrationTimes() = std::make_pair(
+    std::chrono::steady_clock::time_point(), std::chrono::steady_clock::time_point());
   {
+    LoadContextGuard load_context(library_path, loader);
+    int poco_flags = 0;
+    if (nullptr != loader && (loader->getLoadFlags() & LIBRARY_LOAD_LOCAL)) {
+      poco_flags |= Poco::SharedLibrary::SHLIB_LOCAL;
+    }
+    LibraryVersionFile version_file(library_path);
     try {
-      setCurrentlyActiveClassLoader(loader);
-      setCurrentlyLoadingLibraryName(library_path);
-      library_handle = new Poco::SharedLibrary(library_path);
+      // Includes the static initializers of the library, i.e. registerPlugin events
+      ScopedTraceEvent dlopen_trace("dlopen", library_path.c_str());
+      library_handle = new Poco::SharedLibrary(library_path, poco_flags);
     } catch (const Poco::LibraryLoadException & e) {
-      setCurrentlyLoadingLibraryName("");
-      setCurrentlyActiveClassLoader(nullptr);
       throw class_loader::LibraryLoadException(
               "Could not load library (Poco exception = " + std::string(e.message()) + ")");
     } catch (const Poco::LibraryAlreadyLoadedException & e) {
-      setCurrentlyLoadingLibraryName("");
-      setCurrentlyActiveClassLoader(nullptr);
       throw class_loader::LibraryLoadException(
               "Library already loaded (Poco exception = " + std::string(e.message()) + ")");
     } catch (const Poco::NotFoundException & e) {
-      setCurrentlyLoadingLibraryName("");
-      setCurrentlyActiveClassLoader(nullptr);
       throw class_loader::LibraryLoadException(
               "Library not found (Poco exception = " + std::string(e.message()) + ")");
     }
 
-    setCurrentlyLoadingLibraryName("");
-    setCurrentlyActiveClassLoader(nullptr);
+    // Note: Poco::SharedLibrary::getSymbol() throws if there is no such symbol
+    const ClassTableEntry * class_table = nullptr;
+    if (library_handle->hasSymbol(CLASS_LOADER_CLASS_TABLE_SYMBOL)) {
+      class_table = static_cast<const ClassTableEntry *>(
+        library_handle->getSymbol(CLASS_LOADER_CLASS_TABLE_SYMBOL));
+      // The table of a dependency is registered when that library is loaded itself
+      if (!isSymbolOfLibrary(class_table, library_path)) {
+        class_table = nullptr;
+      }
+    }
+    if (nullptr != class_table) {
+      std::chrono::steady_clock::time_point registration_start = std::chrono::steady_clock::now();
+      registerClassTable(class_table, library_path, loader);
+      if (isStatisticsEnabled()) {
+        getRegistrationTimes().second = std::chrono::steady_clock::now();
+        if (getRegistrationTimes().first == std::chrono::steady_clock::time_point()) {
+          getRegistrationTimes().first = registration_start;
+        }
+      }
+    }
   }
 
   assert(library_handle != nullptr);
-  CONSOLE_BRIDGE_logDebug(
+  if (isStatisticsEnabled()) {
+    recordLibraryOpened(
+      library_path, std::chrono::steady_clock::now() - open_start,
+      getRegistrationTimes().second - getRegistrationTimes().first);
+  }
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl: "
     "Successfully loaded library %s into memory (Poco::SharedLibrary handle = %p).",
     library_path.c_str(), reinterpret_cast<void *>(library_handle));
 
   // Graveyard scenario
-  size_t num_lib_objs = allMetaObjectsForLibrary(library_path).size();
+  size_t num_lib_objs = numMetaObjectsForLibrary(library_path);
   if (0 == num_lib_objs) {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader.impl: "
       "Though the library %s was just loaded, it seems no factory metaobjects were registered. "
       "Checking factory graveyard for previously loaded metaobjects...",
       library_path.c_str());
     revivePreviouslyCreateMetaobjectsFromGraveyard(library_path, loader);
+    if (isStatisticsEnabled() && numMetaObjectsForLibrary(library_path) > 0) {
+      recordGraveyardRevival(library_path);
+    }
     // Note: The 'false' indicates we don't want to invoke delete on the metaobject
     purgeGraveyardOfMetaobjects(library_path, loader, false);
   } else {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader.impl: "
       "Library %s generated new factory metaobjects on load. "
       "Destroying graveyarded objects from previous loads...",
@@ -500,15 +1513,14 @@ void loadLibrary(const std::string & library_path, ClassLoader * loader)
 
   // Insert library into global loaded library vector
   boost::recursive_mutex::scoped_lock llv_lock(getLoadedLibraryVectorMutex());
-  LibraryVector & open_libraries = getLoadedLibraryVector();
   // Note: Poco::SharedLibrary automatically calls load() when library passed to constructor
-  open_libraries.push_back(LibraryPair(library_path, library_handle));
+  addLoadedLibrary(LibraryPair(library_path, library_handle));
 }
 
 void unloadLibrary(const std::string & library_path, ClassLoader * loader)
 {
   if (hasANonPurePluginLibraryBeenOpened()) {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader.impl: "
       "Cannot unload %s or ANY other library as a non-pure plugin library was opened. "
       "As class_loader has no idea which libraries class factories were exported from, "
@@ -518,10 +1530,12 @@ void unloadLibrary(const std::string & library_path, ClassLoader * loader)
       "in order for this error to stop happening.",
       library_path.c_str());
   } else {
-    CONSOLE_BRIDGE_logDebug(
+    CLASS_LOADER_LOG_DEBUG(
       "class_loader.impl: "
       "Unloading library %s on behalf of ClassLoader %p...",
       library_path.c_str(), reinterpret_cast<void *>(loader));
+    ScopedTraceEvent trace("unloadLibrary", library_path.c_str());
+    LibraryLoadLock loader_lock(library_path);
     boost::recursive_mutex::scoped_lock lock(getLoadedLibraryVectorMutex());
     LibraryVector & open_libraries = getLoadedLibraryVector();
     LibraryVector::iterator itr = findLoadedLibrary(library_path);
@@ -533,17 +1547,22 @@ void unloadLibrary(const std::string & library_path, ClassLoader * loader)
 
         // Remove from loaded library list as well if no more factories associated with said library
         if (!areThereAnyExistingMetaObjectsForLibrary(library_path)) {
-          CONSOLE_BRIDGE_logDebug(
+          CLASS_LOADER_LOG_DEBUG(
             "class_loader.impl: "
             "There are no more MetaObjects left for %s so unloading library and "
             "removing from loaded library vector.\n",
             library_path.c_str());
-          library->unload();
-          assert(library->isLoaded() == false);
+          removeLoadedLibrary(itr);
+          // In fast exit mode the library is left to the process exit, the handle does not close it
+          if (!isFastExitEnabled()) {
+            library->unload();
+            assert(library->isLoaded() == false);
+          }
+          // Also when statistics are disabled, as the types recorded for the library are gone
+          recordLibraryClosed(library_path);
           delete (library);
-          itr = open_libraries.erase(itr);
         } else {
-          CONSOLE_BRIDGE_logDebug(
+          CLASS_LOADER_LOG_DEBUG(
             "class_loader.impl: "
             "MetaObjects still remain in memory meaning other ClassLoaders are still using library"
             ", keeping library %s open.",
@@ -562,6 +1581,25 @@ void unloadLibrary(const std::string & library_path, ClassLoader * loader)
 }
 
 
+static std::atomic<bool> & getFastExitFlag()
+{
+  static std::atomic<bool> enabled(
+    nullptr != getenv("CLASS_LOADER_FAST_EXIT") &&
+    0 == strcmp(getenv("CLASS_LOADER_FAST_EXIT"), "1"));
+  return enabled;
+}
+
+void setFastExitEnabled(bool enabled)
+{
+  getFastExitFlag().store(enabled, std::memory_order_relaxed);
+}
+
+bool isFastExitEnabled()
+{
+  return getFastExitFlag().load(std::memory_order_relaxed);
+}
+
+
 // Other
 
 void printDebugInfoToScreen()
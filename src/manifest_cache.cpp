@@ -0,0 +1,377 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "class_loader/manifest_cache.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "class_loader/logging.hpp"
+
+namespace class_loader
+{
+namespace impl
+{
+
+// The cache file is plain text, one line per record:
+//   class_loader_manifest <version>
+//   L <device> <inode> <modification time> <size> <library file>
+//   C <typeid(Base).name()> <class name>
+// C records belong to the L record preceding them.
+static const char * const MANIFEST_CACHE_HEADER = "class_loader_manifest 1";
+
+struct LibraryFileStamp
+{
+  unsigned long long device;
+  unsigned long long inode;
+  long long modification_time;
+  long long size;
+
+  bool operator==(const LibraryFileStamp & other) const
+  {
+    return device == other.device && inode == other.inode &&
+           modification_time == other.modification_time && size == other.size;
+  }
+};
+
+struct LibraryManifest
+{
+  LibraryFileStamp stamp;
+  std::vector<std::pair<BaseClassName, ClassName>> classes;
+};
+
+typedef std::map<std::string, LibraryManifest> LibraryFileToManifestMap;
+
+struct ManifestCache
+{
+  ManifestCache()
+  : configured(false), loaded(false) {}
+
+  // Manifests recorded since the last flush are written at exit at the latest
+  ~ManifestCache();
+
+  boost::mutex mutex;
+  bool configured;
+  std::string path;
+  bool loaded;
+  LibraryFileToManifestMap manifests;
+  // The manifests recorded by cacheManifest() which are not written to the cache file yet
+  LibraryFileToManifestMap pending;
+};
+
+static ManifestCache & getManifestCache()
+{
+  static ManifestCache cache;
+  return cache;
+}
+
+// Note: The caller must hold cache.mutex
+static void configureManifestCache(ManifestCache & cache)
+{
+  if (!cache.configured) {
+    const char * cache_path = getenv("CLASS_LOADER_MANIFEST_CACHE");
+    cache.path = (nullptr == cache_path) ? "" : cache_path;
+    cache.configured = true;
+  }
+}
+
+static bool getLibraryFileStamp(
+  const std::string & library_path, std::string & library_file, LibraryFileStamp & stamp)
+{
+#ifndef _WIN32
+  library_file = findLibraryFile(library_path);
+  struct stat file_status;
+  if (library_file.empty() || 0 != stat(library_file.c_str(), &file_status)) {
+    return false;
+  }
+  stamp.device = file_status.st_dev;
+  stamp.inode = file_status.st_ino;
+  stamp.modification_time = file_status.st_mtime;
+  stamp.size = file_status.st_size;
+  return true;
+#else
+  (void)library_path;
+  (void)library_file;
+  (void)stamp;
+  return false;
+#endif
+}
+
+static void readManifestCacheFile(const std::string & cache_path, LibraryFileToManifestMap & manifests)
+{
+  std::ifstream in(cache_path.c_str());
+  std::string line;
+  if (!std::getline(in, line) || line != MANIFEST_CACHE_HEADER) {
+    return;
+  }
+
+  LibraryManifest * manifest = nullptr;
+  while (std::getline(in, line)) {
+    if (line.size() < 2) {
+      continue;
+    }
+    std::istringstream fields(line.substr(2));
+    if ('L' == line[0]) {
+      LibraryFileStamp stamp;
+      std::string library_file;
+      fields >> stamp.device >> stamp.inode >> stamp.modification_time >> stamp.size;
+      fields.get();
+      std::getline(fields, library_file);
+      if (!fields.fail() && !library_file.empty()) {
+        manifest = &manifests[library_file];
+        manifest->stamp = stamp;
+        manifest->classes.clear();
+      } else {
+        manifest = nullptr;
+      }
+    } else if ('C' == line[0] && nullptr != manifest) {
+      std::string base_class_name, class_name;
+      fields >> base_class_name;
+      fields.get();
+      std::getline(fields, class_name);
+      if (!fields.fail() && !class_name.empty()) {
+        manifest->classes.push_back(std::make_pair(base_class_name, class_name));
+      }
+    }
+  }
+}
+
+/**
+ * Serializes the updates of a cache file between processes, for as long as it exists.
+ * Readers do not take the lock, they always see a complete file thanks to the atomic rename.
+ */
+class ManifestCacheFileLock
+{
+public:
+  explicit ManifestCacheFileLock(const std::string & cache_path)
+  : fd_(-1)
+  {
+#ifndef _WIN32
+    fd_ = open((cache_path + ".lock").c_str(), O_RDWR | O_CREAT, 0666);
+    if (-1 != fd_ && 0 != flock(fd_, LOCK_EX)) {
+      close(fd_);
+      fd_ = -1;
+    }
+#else
+    (void)cache_path;
+#endif
+  }
+
+  ~ManifestCacheFileLock()
+  {
+#ifndef _WIN32
+    if (-1 != fd_) {
+      flock(fd_, LOCK_UN);
+      close(fd_);
+    }
+#endif
+  }
+
+private:
+  int fd_;
+};
+
+static bool writeManifestCacheFile(
+  const std::string & cache_path, const LibraryFileToManifestMap & manifests)
+{
+  // Write to a temporary file first so concurrent readers never see a partial cache
+  std::ostringstream temporary_path;
+  temporary_path << cache_path << ".tmp";
+#ifndef _WIN32
+  temporary_path << "." << getpid();
+#endif
+  {
+    std::ofstream out(temporary_path.str().c_str(), std::ios::trunc);
+    out << MANIFEST_CACHE_HEADER << "\n";
+    for (auto & it : manifests) {
+      const LibraryFileStamp & stamp = it.second.stamp;
+      out << "L " << stamp.device << " " << stamp.inode << " " << stamp.modification_time <<
+        " " << stamp.size << " " << it.first << "\n";
+      for (auto & base_and_class : it.second.classes) {
+        out << "C " << base_and_class.first << " " << base_and_class.second << "\n";
+      }
+    }
+    out.flush();
+    if (!out) {
+      std::remove(temporary_path.str().c_str());
+      return false;
+    }
+  }
+  return 0 == std::rename(temporary_path.str().c_str(), cache_path.c_str());
+}
+
+// Note: The caller must hold cache.mutex
+static bool flushPendingManifests(ManifestCache & cache)
+{
+  if (cache.path.empty() || cache.pending.empty()) {
+    return true;
+  }
+
+  // Other processes may have added libraries since the cache was read
+  ManifestCacheFileLock file_lock(cache.path);
+  LibraryFileToManifestMap manifests;
+  readManifestCacheFile(cache.path, manifests);
+  for (auto & it : cache.pending) {
+    manifests[it.first] = it.second;
+  }
+  cache.pending.clear();
+  cache.manifests.swap(manifests);
+
+  return writeManifestCacheFile(cache.path, cache.manifests);
+}
+
+ManifestCache::~ManifestCache()
+{
+  // Note: Not logged, console_bridge may already be destroyed
+  flushPendingManifests(*this);
+}
+
+void setManifestCachePath(const std::string & cache_path)
+{
+  ManifestCache & cache = getManifestCache();
+  boost::mutex::scoped_lock lock(cache.mutex);
+  // Manifests recorded so far belong to the previous cache file
+  if (!flushPendingManifests(cache)) {
+    CONSOLE_BRIDGE_logWarn(
+      "class_loader.impl: Could not write manifest cache %s.", cache.path.c_str());
+  }
+  cache.configured = true;
+  cache.path = cache_path;
+  cache.loaded = false;
+  cache.manifests.clear();
+}
+
+std::string getManifestCachePath()
+{
+  ManifestCache & cache = getManifestCache();
+  boost::mutex::scoped_lock lock(cache.mutex);
+  configureManifestCache(cache);
+  return cache.path;
+}
+
+bool findCachedManifest(
+  const std::string & library_path,
+  std::vector<std::pair<BaseClassName, ClassName>> & classes)
+{
+  ManifestCache & cache = getManifestCache();
+  boost::mutex::scoped_lock lock(cache.mutex);
+  configureManifestCache(cache);
+  if (cache.path.empty()) {
+    return false;
+  }
+  if (!cache.loaded) {
+    readManifestCacheFile(cache.path, cache.manifests);
+    cache.loaded = true;
+  }
+
+  std::string library_file;
+  LibraryFileStamp stamp;
+  if (!getLibraryFileStamp(library_path, library_file, stamp)) {
+    return false;
+  }
+  LibraryFileToManifestMap::const_iterator itr = cache.manifests.find(library_file);
+  if (itr == cache.manifests.end() || !(itr->second.stamp == stamp)) {
+    return false;
+  }
+  classes = itr->second.classes;
+  CLASS_LOADER_LOG_DEBUG(
+    "class_loader.impl: Found %zu classes of library %s in manifest cache %s.",
+    classes.size(), library_path.c_str(), cache.path.c_str());
+  return true;
+}
+
+void cacheManifest(
+  const std::string & library_path,
+  const std::vector<std::pair<BaseClassName, ClassName>> & classes)
+{
+  ManifestCache & cache = getManifestCache();
+  {
+    boost::mutex::scoped_lock lock(cache.mutex);
+    configureManifestCache(cache);
+    if (cache.path.empty()) {
+      return;
+    }
+  }
+
+  // Looking up the file does not need the cache, so loading threads only contend on the update
+  std::string library_file;
+  LibraryManifest manifest;
+  if (!getLibraryFileStamp(library_path, library_file, manifest.stamp)) {
+    return;
+  }
+  manifest.classes = classes;
+
+  boost::mutex::scoped_lock lock(cache.mutex);
+  if (cache.path.empty()) {
+    return;
+  }
+  if (!cache.loaded) {
+    readManifestCacheFile(cache.path, cache.manifests);
+    cache.loaded = true;
+  }
+  LibraryFileToManifestMap::iterator itr = cache.manifests.find(library_file);
+  if (itr != cache.manifests.end() && itr->second.stamp == manifest.stamp &&
+    itr->second.classes == classes)
+  {
+    return;
+  }
+  cache.pending[library_file] = manifest;
+  cache.manifests[library_file] = manifest;
+}
+
+bool flushManifestCache()
+{
+  ManifestCache & cache = getManifestCache();
+  boost::mutex::scoped_lock lock(cache.mutex);
+  if (!flushPendingManifests(cache)) {
+    CONSOLE_BRIDGE_logWarn(
+      "class_loader.impl: Could not write manifest cache %s.", cache.path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace impl
+}  // namespace class_loader
@@ -31,6 +31,7 @@
 
 #include "class_loader/meta_object.hpp"
 #include "class_loader/class_loader.hpp"
+#include "class_loader/logging.hpp"
 
 namespace class_loader
 {
@@ -42,9 +43,10 @@ AbstractMetaObjectBase::AbstractMetaObjectBase(
 : associated_library_path_("Unknown"),
   base_class_name_(base_class_name),
   class_name_(class_name),
-  typeid_base_class_name_("UNSET")
+  typeid_base_class_name_("UNSET"),
+  shadowed_version_(nullptr)
 {
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl.AbstractMetaObjectBase: "
     "Creating MetaObject %p (base = %s, derived = %s, library path = %s)",
     this, baseClassName().c_str(), className().c_str(), getAssociatedLibraryPath().c_str());
@@ -52,7 +54,7 @@ AbstractMetaObjectBase::AbstractMetaObjectBase(
 
 AbstractMetaObjectBase::~AbstractMetaObjectBase()
 {
-  CONSOLE_BRIDGE_logDebug(
+  CLASS_LOADER_LOG_DEBUG(
     "class_loader.impl.AbstractMetaObjectBase: "
     "Destroying MetaObject %p (base = %s, derived = %s, library path = %s)",
     this, baseClassName().c_str(), className().c_str(), getAssociatedLibraryPath().c_str());
@@ -117,5 +119,15 @@ ClassLoaderVector AbstractMetaObjectBase::getAssociatedClassLoaders()
   return associated_class_loaders_;
 }
 
+AbstractMetaObjectBase * AbstractMetaObjectBase::getShadowedVersion() const
+{
+  return shadowed_version_;
+}
+
+void AbstractMetaObjectBase::setShadowedVersion(AbstractMetaObjectBase * meta_obj)
+{
+  shadowed_version_ = meta_obj;
+}
+
 }  // namespace impl
 }  // namespace class_loader
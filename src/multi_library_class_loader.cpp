@@ -29,49 +29,136 @@
 
 #include "class_loader/multi_library_class_loader.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <map>
+#include <memory>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "class_loader/manifest_cache.hpp"
+
 namespace class_loader
 {
 
-MultiLibraryClassLoader::MultiLibraryClassLoader(bool enable_ondemand_loadunload)
-: enable_ondemand_loadunload_(enable_ondemand_loadunload)
+MultiLibraryClassLoader::MultiLibraryClassLoader(
+  bool enable_ondemand_loadunload, unsigned int load_flags)
+: enable_ondemand_loadunload_(enable_ondemand_loadunload),
+  load_flags_(load_flags),
+  snapshot_(std::make_shared<Snapshot>()),
+  residency_budget_(0),
+  residency_evictions_(0),
+  residency_clock_(0)
 {
 }
 
 MultiLibraryClassLoader::~MultiLibraryClassLoader()
 {
   shutdownAllClassLoaders();
+  class_loader::impl::flushManifestCache();
 }
 
 std::vector<std::string> MultiLibraryClassLoader::getRegisteredLibraries()
 {
   std::vector<std::string> libraries;
-  for (auto & it : active_class_loaders_) {
-    if (it.second != nullptr) {
-      libraries.push_back(it.first);
-    }
+  for (auto & loader : getSnapshot()->loaders) {
+    libraries.push_back(loader->getLibraryPath());
   }
   return libraries;
 }
 
 ClassLoader * MultiLibraryClassLoader::getClassLoaderForLibrary(const std::string & library_path)
 {
-  LibraryToClassLoaderMap::iterator itr = active_class_loaders_.find(library_path);
-  if (itr != active_class_loaders_.end()) {
+  std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+  std::unordered_map<LibraryPath, ClassLoader *>::const_iterator itr =
+    snapshot->loaders_by_library.find(library_path);
+  if (itr != snapshot->loaders_by_library.end()) {
     return itr->second;
   } else {return nullptr;}
 }
 
 ClassLoaderVector MultiLibraryClassLoader::getAllAvailableClassLoaders()
 {
-  ClassLoaderVector loaders;
-  for (auto & it : active_class_loaders_) {
-    loaders.push_back(it.second);
+  return getSnapshot()->loaders;
+}
+
+void MultiLibraryClassLoader::publishSnapshot(const std::shared_ptr<Snapshot> & snapshot)
+{
+  std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(snapshot));
+}
+
+void MultiLibraryClassLoader::addClassLoaders(const std::vector<NewClassLoader> & new_loaders)
+{
+  ClassLoaderVector rejected;
+  {
+    boost::mutex::scoped_lock lock(loader_mutex_);
+    std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(*getSnapshot());
+    bool added = false;
+    for (auto & new_loader : new_loaders) {
+      if (nullptr == new_loader.loader) {
+        continue;
+      }
+      std::string library_path = new_loader.loader->getLibraryPath();
+      if (!active_class_loaders_.insert(std::make_pair(library_path, new_loader.loader)).second) {
+        rejected.push_back(new_loader.loader);
+        continue;
+      }
+      snapshot->loaders_by_library[library_path] = new_loader.loader;
+      if (new_loader.indexed) {
+        addClassesToIndex(*snapshot, new_loader.loader, new_loader.classes);
+      }
+      added = true;
+    }
+    if (added) {
+      snapshot->loaders.clear();
+      snapshot->loaders.reserve(active_class_loaders_.size());
+      for (auto & it : active_class_loaders_) {
+        snapshot->loaders.push_back(it.second);
+      }
+      publishSnapshot(snapshot);
+    }
+  }
+  // Destroyed once loader_mutex_ is released as this may close their libraries
+  for (auto & loader : rejected) {
+    delete (loader);
+  }
+}
+
+void MultiLibraryClassLoader::removeClassLoader(ClassLoader * loader)
+{
+  removeClassLoaders(ClassLoaderVector(1, loader));
+}
+
+void MultiLibraryClassLoader::removeClassLoaders(const ClassLoaderVector & loaders)
+{
+  if (loaders.empty()) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(loader_mutex_);
+  std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(*getSnapshot());
+  std::unordered_set<ClassLoader *> removed(loaders.begin(), loaders.end());
+  for (auto & loader : loaders) {
+    active_class_loaders_.erase(loader->getLibraryPath());
+    residency_.erase(loader);
+    snapshot->loaders_by_library.erase(loader->getLibraryPath());
+    removeClassLoaderFromIndex(*snapshot, loader);
   }
-  return loaders;
+  snapshot->loaders.erase(
+    std::remove_if(
+      snapshot->loaders.begin(), snapshot->loaders.end(),
+      [&removed](ClassLoader * loader) {return removed.count(loader) > 0;}),
+    snapshot->loaders.end());
+  publishSnapshot(snapshot);
 }
 
 bool MultiLibraryClassLoader::isLibraryAvailable(const std::string & library_name)
@@ -79,32 +166,392 @@ bool MultiLibraryClassLoader::isLibraryAvailable(const std::string & library_nam
   return getClassLoaderForLibrary(library_name) != nullptr;
 }
 
+ClassLoader * MultiLibraryClassLoader::findIndexedClassLoader(
+  const std::string & class_name, const char * typeid_base_class_name)
+{
+  std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+  ClassToClassLoaderIndex::const_iterator itr = snapshot->class_index.find(class_name);
+  if (itr != snapshot->class_index.end()) {
+    for (auto & entry : itr->second) {
+      if (0 == std::strcmp(entry.typeid_base_class_name.c_str(), typeid_base_class_name)) {
+        return entry.loader;
+      }
+    }
+  }
+  return nullptr;
+}
+
+ClassLoader * MultiLibraryClassLoader::discoverClassLoaderForClass(
+  const std::string & class_name, const char * typeid_base_class_name)
+{
+  ClassLoaderVector unindexed_loaders;
+  std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+  for (auto & loader : snapshot->loaders) {
+    if (snapshot->indexed_class_loaders.find(loader) == snapshot->indexed_class_loaders.end()) {
+      unindexed_loaders.push_back(loader);
+    }
+  }
+
+  for (auto & loader : unindexed_loaders) {
+    loader->waitForPrefetch();
+    bool was_loaded = loader->isLibraryLoaded();
+    if (!was_loaded) {
+      loader->loadLibrary();
+    }
+    indexClassLoader(loader);
+    if (findIndexedClassLoader(class_name, typeid_base_class_name) == loader) {
+      return loader;
+    }
+    if (!was_loaded) {
+      loader->unloadLibrary();
+    }
+  }
+  return nullptr;
+}
+
+bool MultiLibraryClassLoader::isClassIndexed(
+  const Snapshot & snapshot, ClassLoader * loader, const std::string & class_name,
+  const char * typeid_base_class_name)
+{
+  ClassToClassLoaderIndex::const_iterator entries = snapshot.class_index.find(class_name);
+  if (entries == snapshot.class_index.end()) {
+    return false;
+  }
+  for (auto & entry : entries->second) {
+    if (entry.loader == loader &&
+      0 == std::strcmp(entry.typeid_base_class_name.c_str(), typeid_base_class_name))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> MultiLibraryClassLoader::getIndexedClasses(
+  const Snapshot & snapshot, ClassLoader * loader, const char * typeid_base_class_name)
+{
+  std::vector<std::string> classes;
+  forEachIndexedClass(
+    snapshot, loader, typeid_base_class_name,
+    [&classes](const std::string & class_name) {classes.push_back(class_name);});
+  return classes;
+}
+
+bool MultiLibraryClassLoader::findClassesToIndex(
+  ClassLoader * loader, std::vector<std::pair<std::string, std::string>> & classes)
+{
+  if (loader->isLibraryLoaded()) {
+    classes = class_loader::impl::getAllClassesForLibrary(loader->getLibraryPath());
+    class_loader::impl::cacheManifest(loader->getLibraryPath(), classes);
+    return true;
+  }
+  return class_loader::impl::findCachedManifest(loader->getLibraryPath(), classes);
+}
+
+void MultiLibraryClassLoader::indexClassLoader(ClassLoader * loader)
+{
+  std::vector<std::pair<std::string, std::string>> classes;
+  if (findClassesToIndex(loader, classes)) {
+    addClassLoaderToIndex(loader, classes);
+  }
+}
+
+void MultiLibraryClassLoader::addClassLoaderToIndex(
+  ClassLoader * loader, const std::vector<std::pair<std::string, std::string>> & classes)
+{
+  boost::mutex::scoped_lock lock(loader_mutex_);
+  std::shared_ptr<const Snapshot> current = getSnapshot();
+  if (current->loaders_by_library.find(loader->getLibraryPath()) ==
+    current->loaders_by_library.end() ||
+    current->indexed_class_loaders.find(loader) != current->indexed_class_loaders.end())
+  {
+    return;
+  }
+  std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(*current);
+  addClassesToIndex(*snapshot, loader, classes);
+  publishSnapshot(snapshot);
+}
+
+void MultiLibraryClassLoader::addClassesToIndex(
+  Snapshot & snapshot, ClassLoader * loader,
+  const std::vector<std::pair<std::string, std::string>> & classes)
+{
+  std::string library_path = loader->getLibraryPath();
+  std::vector<std::string> & indexed_classes = snapshot.indexed_class_loaders[loader];
+  indexed_classes.reserve(indexed_classes.size() + classes.size());
+  for (auto & base_and_class : classes) {
+    std::vector<ClassIndexEntry> & entries = snapshot.class_index[base_and_class.second];
+    std::vector<ClassIndexEntry>::iterator pos = std::lower_bound(
+      entries.begin(), entries.end(), library_path,
+      [](const ClassIndexEntry & entry, const std::string & path) {
+        return entry.loader->getLibraryPath() < path;
+      });
+    entries.insert(pos, ClassIndexEntry{base_and_class.first, loader});
+    indexed_classes.push_back(base_and_class.second);
+  }
+}
+
+void MultiLibraryClassLoader::removeClassLoaderFromIndex(Snapshot & snapshot, ClassLoader * loader)
+{
+  std::map<ClassLoader *, std::vector<std::string>>::iterator itr =
+    snapshot.indexed_class_loaders.find(loader);
+  if (itr == snapshot.indexed_class_loaders.end()) {
+    return;
+  }
+  for (auto & class_name : itr->second) {
+    ClassToClassLoaderIndex::iterator entries = snapshot.class_index.find(class_name);
+    if (entries == snapshot.class_index.end()) {
+      continue;
+    }
+    std::vector<ClassIndexEntry> & loaders = entries->second;
+    loaders.erase(
+      std::remove_if(
+        loaders.begin(), loaders.end(),
+        [loader](const ClassIndexEntry & entry) {return entry.loader == loader;}),
+      loaders.end());
+    if (loaders.empty()) {
+      snapshot.class_index.erase(entries);
+    }
+  }
+  snapshot.indexed_class_loaders.erase(itr);
+}
+
 void MultiLibraryClassLoader::loadLibrary(const std::string & library_path)
 {
   if (!isLibraryAvailable(library_path)) {
-    active_class_loaders_[library_path] =
-      new class_loader::ClassLoader(library_path, isOnDemandLoadUnloadEnabled());
+    std::vector<NewClassLoader> new_loaders(1);
+    new_loaders[0].loader =
+      new class_loader::ClassLoader(library_path, isOnDemandLoadUnloadEnabled(), load_flags_);
+    new_loaders[0].indexed = findClassesToIndex(new_loaders[0].loader, new_loaders[0].classes);
+    addClassLoaders(new_loaders);
   }
 }
 
-void MultiLibraryClassLoader::shutdownAllClassLoaders()
+std::vector<LibraryLoadResult>
+MultiLibraryClassLoader::loadLibraries(const std::vector<std::string> & library_paths)
+{
+  std::vector<LibraryLoadResult> results(library_paths.size());
+  std::vector<size_t> pending;
+  std::unordered_set<std::string> seen_paths;
+  for (size_t i = 0; i < library_paths.size(); ++i) {
+    results[i].library_path = library_paths[i];
+    results[i].success = false;
+    results[i].prefetch_time = std::chrono::nanoseconds::zero();
+    results[i].load_time = std::chrono::nanoseconds::zero();
+
+    bool is_duplicate = !seen_paths.insert(library_paths[i]).second;
+    if (is_duplicate || isLibraryAvailable(library_paths[i])) {
+      results[i].success = true;
+    } else {
+      pending.push_back(i);
+    }
+  }
+
+  // The ClassLoaders of the batch are bound at once, when all were created
+  std::vector<NewClassLoader> new_loaders(pending.size(), NewClassLoader{nullptr, false, {}});
+  std::atomic<size_t> next(0);
+  // Any other exception ends the batch, it is rethrown on the calling thread
+  std::exception_ptr failure;
+  boost::mutex failure_mutex;
+  auto worker = [&]() {
+      for (size_t n = next++; n < pending.size(); n = next++) {
+        LibraryLoadResult & result = results[pending[n]];
+        try {
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+          class_loader::impl::prefetchLibrary(
+            result.library_path, 0 != (load_flags_ & LIBRARY_PREFETCH_DEPENDENCIES));
+          std::chrono::steady_clock::time_point prefetched = std::chrono::steady_clock::now();
+          result.prefetch_time = prefetched - start;
+
+          try {
+            NewClassLoader & new_loader = new_loaders[n];
+            new_loader.loader = new class_loader::ClassLoader(
+              result.library_path, isOnDemandLoadUnloadEnabled(), load_flags_);
+            new_loader.indexed = findClassesToIndex(new_loader.loader, new_loader.classes);
+            result.success = true;
+          } catch (const class_loader::ClassLoaderException & e) {
+            result.error = e.what();
+          }
+          result.load_time = std::chrono::steady_clock::now() - prefetched;
+        } catch (...) {
+          boost::mutex::scoped_lock lock(failure_mutex);
+          if (!failure) {
+            failure = std::current_exception();
+          }
+          next = pending.size();
+        }
+      }
+    };
+
+  size_t num_workers = std::min<size_t>(
+    pending.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> workers;
+  workers.reserve(num_workers);
+  for (size_t i = 1; i < num_workers; ++i) {
+    try {
+      workers.push_back(std::thread(worker));
+    } catch (const std::system_error & e) {
+      // E.g. the thread limit is reached, the workers started so far take over the batch
+      CLASS_LOADER_LOG_DEBUG(
+        "class_loader::MultiLibraryClassLoader: "
+        "Loading libraries with %zu threads only as no more could be started: %s",
+        i, e.what());
+      break;
+    }
+  }
+  worker();
+  for (auto & thread : workers) {
+    thread.join();
+  }
+  addClassLoaders(new_loaders);
+  // The manifests of the batch are written at once
+  class_loader::impl::flushManifestCache();
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+  return results;
+}
+
+std::vector<std::shared_future<void>>
+MultiLibraryClassLoader::prefetchLibraries(const std::vector<std::string> & library_paths)
 {
-  std::vector<std::string> available_libraries = getRegisteredLibraries();
+  std::vector<std::shared_future<void>> prefetches;
+  for (auto & library_path : library_paths) {
+    ClassLoader * loader = getClassLoaderForLibrary(library_path);
+    if (nullptr != loader && !loader->isLibraryLoaded()) {
+      prefetches.push_back(loader->prefetch());
+    }
+  }
+  return prefetches;
+}
 
-  for (auto & library_path : getRegisteredLibraries()) {
-    unloadLibrary(library_path);
+void MultiLibraryClassLoader::setResidencyBudget(std::size_t budget)
+{
+  {
+    boost::mutex::scoped_lock lock(loader_mutex_);
+    residency_budget_ = budget;
+  }
+  enforceResidencyBudget(nullptr);
+}
+
+ResidencyStatistics MultiLibraryClassLoader::getResidencyStatistics()
+{
+  ResidencyStatistics statistics = ResidencyStatistics();
+  std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+  boost::mutex::scoped_lock lock(loader_mutex_);
+  statistics.budget = residency_budget_;
+  statistics.evictions = residency_evictions_;
+  for (auto & loader : snapshot->loaders) {
+    if (loader->isLibraryLoaded()) {
+      statistics.resident_size += getMappedSize(loader);
+      ++statistics.resident_libraries;
+      if (loader->isLibraryPinned()) {
+        ++statistics.pinned_libraries;
+      }
+    }
+  }
+  return statistics;
+}
+
+void MultiLibraryClassLoader::touchClassLoader(ClassLoader * loader)
+{
+  // Uses are only recorded while a budget is set, so plain lookups do not contend on loader_mutex_
+  if (0 == residency_budget_) {
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(loader_mutex_);
+    residency_[loader].last_use = ++residency_clock_;
+  }
+  enforceResidencyBudget(loader);
+}
+
+std::size_t MultiLibraryClassLoader::getMappedSize(ClassLoader * loader)
+{
+  LibraryResidency & residency = residency_[loader];
+  if (0 == residency.mapped_size && loader->isLibraryLoaded()) {
+    residency.mapped_size = class_loader::impl::getLibraryMappedSize(loader->getLibraryPath());
+  }
+  return residency.mapped_size;
+}
+
+void MultiLibraryClassLoader::enforceResidencyBudget(ClassLoader * in_use)
+{
+  // No library can be unloaded then
+  if (class_loader::impl::hasANonPurePluginLibraryBeenOpened()) {
+    return;
+  }
+
+  std::vector<std::pair<std::uint64_t, ClassLoader *>> idle_loaders;
+  std::size_t resident_size = 0;
+  std::shared_ptr<const Snapshot> snapshot = getSnapshot();
+  {
+    boost::mutex::scoped_lock lock(loader_mutex_);
+    if (0 == residency_budget_) {
+      return;
+    }
+    for (auto & loader : snapshot->loaders) {
+      // The library in use is accounted for with its last known size even if not loaded yet
+      if (loader == in_use || loader->isLibraryLoaded()) {
+        resident_size += getMappedSize(loader);
+      }
+      if (loader != in_use && loader->isLibraryLoaded() && 0 == loader->getInstanceCount() &&
+        !loader->isLibraryPinned())
+      {
+        idle_loaders.push_back(std::make_pair(residency_[loader].last_use, loader));
+      }
+    }
+    if (resident_size <= residency_budget_) {
+      return;
+    }
+  }
+
+  std::sort(idle_loaders.begin(), idle_loaders.end());
+  for (auto & idle_loader : idle_loaders) {
+    ClassLoader * loader = idle_loader.second;
+    boost::mutex::scoped_lock lock(loader_mutex_);
+    if (resident_size <= residency_budget_) {
+      break;
+    }
+    CLASS_LOADER_LOG_DEBUG(
+      "class_loader::MultiLibraryClassLoader: "
+      "Unloading library %s to stay within the residency budget of %zu bytes.",
+      loader->getLibraryPath().c_str(), residency_budget_.load());
+    std::size_t mapped_size = getMappedSize(loader);
+    lock.unlock();
+    // Skips the library if an instance has been created from it since it was picked
+    bool evicted = loader->evictLibrary();
+    lock.lock();
+    if (evicted) {
+      resident_size -= std::min(resident_size, mapped_size);
+      ++residency_evictions_;
+    }
+  }
+}
+
+void MultiLibraryClassLoader::shutdownAllClassLoaders()
+{
+  // Unbinds the libraries in one go, copying the snapshot for each of them would be quadratic
+  ClassLoaderVector unloaded;
+  for (auto & loader : getAllAvailableClassLoaders()) {
+    if (0 == loader->unloadLibrary()) {
+      unloaded.push_back(loader);
+    }
+  }
+  removeClassLoaders(unloaded);
+  for (auto & loader : unloaded) {
+    delete (loader);
   }
 }
 
 int MultiLibraryClassLoader::unloadLibrary(const std::string & library_path)
 {
   int remaining_unloads = 0;
-  LibraryToClassLoaderMap::iterator itr = active_class_loaders_.find(library_path);
-  if (itr != active_class_loaders_.end()) {
-    ClassLoader * loader = itr->second;
+  ClassLoader * loader = getClassLoaderForLibrary(library_path);
+  if (nullptr != loader) {
     if (0 == (remaining_unloads = loader->unloadLibrary())) {
+      removeClassLoader(loader);
       delete (loader);
-      active_class_loaders_.erase(itr);
     }
   }
   return remaining_unloads;
@@ -0,0 +1,240 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "class_loader/statistics.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+namespace class_loader
+{
+namespace impl
+{
+
+typedef std::pair<std::string, std::string> ClassKey;  // (typeid(Base).name(), class name)
+
+struct StatisticsRegistry
+{
+  boost::mutex mutex;
+  std::map<std::string, LibraryStatistics> libraries;
+  std::map<ClassKey, ClassStatistics> classes;
+  struct TypeEntry
+  {
+    ClassStatistics * statistics;
+    // The library the type_info of the key belongs to, the entry is erased when it is closed
+    std::string library_path;
+  };
+  // Dynamic type of the instances -> statistics of their class, used on destruction
+  std::map<std::type_index, TypeEntry> classes_by_type;
+};
+
+static StatisticsRegistry & getStatisticsRegistry()
+{
+  static StatisticsRegistry registry;
+  return registry;
+}
+
+static std::atomic<bool> & getStatisticsEnabledFlag()
+{
+  static std::atomic<bool> enabled(
+    nullptr != getenv("CLASS_LOADER_STATISTICS") &&
+    0 == strcmp(getenv("CLASS_LOADER_STATISTICS"), "1"));
+  return enabled;
+}
+
+// Note: The caller must hold the registry mutex
+static LibraryStatistics & getLibraryStatistics(
+  StatisticsRegistry & registry, const std::string & library_path)
+{
+  std::map<std::string, LibraryStatistics>::iterator itr = registry.libraries.find(library_path);
+  if (itr == registry.libraries.end()) {
+    LibraryStatistics statistics;
+    statistics.library_path = library_path;
+    statistics.load_count = 0;
+    statistics.unload_count = 0;
+    statistics.graveyard_revivals = 0;
+    statistics.total_open_time = std::chrono::nanoseconds::zero();
+    statistics.last_open_time = std::chrono::nanoseconds::zero();
+    statistics.last_static_init_time = std::chrono::nanoseconds::zero();
+    itr = registry.libraries.insert(std::make_pair(library_path, statistics)).first;
+  }
+  return itr->second;
+}
+
+void setStatisticsEnabled(bool enabled)
+{
+  getStatisticsEnabledFlag().store(enabled, std::memory_order_relaxed);
+}
+
+bool isStatisticsEnabled()
+{
+  return getStatisticsEnabledFlag().load(std::memory_order_relaxed);
+}
+
+Statistics getStatistics()
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+
+  Statistics statistics;
+  statistics.enabled = isStatisticsEnabled();
+  for (auto & it : registry.libraries) {
+    statistics.libraries.push_back(it.second);
+  }
+  for (auto & it : registry.classes) {
+    statistics.classes.push_back(it.second);
+  }
+  return statistics;
+}
+
+void resetStatistics()
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  registry.libraries.clear();
+  registry.classes_by_type.clear();
+  registry.classes.clear();
+}
+
+void recordLibraryOpened(
+  const std::string & library_path, std::chrono::nanoseconds open_time,
+  std::chrono::nanoseconds static_init_time)
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  LibraryStatistics & statistics = getLibraryStatistics(registry, library_path);
+  ++statistics.load_count;
+  statistics.total_open_time += open_time;
+  statistics.last_open_time = open_time;
+  statistics.last_static_init_time = static_init_time;
+}
+
+void recordLibraryClosed(const std::string & library_path)
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  if (isStatisticsEnabled()) {
+    ++getLibraryStatistics(registry, library_path).unload_count;
+  }
+
+  // The type_info objects of the classes are gone with the library
+  std::map<std::type_index, StatisticsRegistry::TypeEntry>::iterator itr =
+    registry.classes_by_type.begin();
+  while (itr != registry.classes_by_type.end()) {
+    if (itr->second.library_path == library_path) {
+      itr = registry.classes_by_type.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+}
+
+void recordGraveyardRevival(const std::string & library_path)
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  ++getLibraryStatistics(registry, library_path).graveyard_revivals;
+}
+
+void recordInstanceCreated(
+  AbstractMetaObjectBase * factory, const std::type_info & type,
+  std::chrono::nanoseconds create_time)
+{
+  ClassKey key(factory->typeidBaseClassName(), factory->className());
+
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  std::map<ClassKey, ClassStatistics>::iterator itr = registry.classes.find(key);
+  if (itr == registry.classes.end()) {
+    ClassStatistics statistics;
+    statistics.class_name = factory->className();
+    statistics.base_class_name = factory->baseClassName();
+    statistics.create_count = 0;
+    statistics.live_instances = 0;
+    statistics.total_create_time = std::chrono::nanoseconds::zero();
+    statistics.create_latency_histogram.fill(0);
+    itr = registry.classes.insert(std::make_pair(key, statistics)).first;
+  }
+
+  ClassStatistics & statistics = itr->second;
+  statistics.library_path = factory->getAssociatedLibraryPath();
+  ++statistics.create_count;
+  ++statistics.live_instances;
+  statistics.total_create_time += create_time;
+  std::size_t bucket = 0;
+  for (uint64_t ns = create_time.count() > 0 ? create_time.count() : 0; ns > 1; ns >>= 1) {
+    ++bucket;
+  }
+  ++statistics.create_latency_histogram[std::min(bucket, CREATE_LATENCY_BUCKETS - 1)];
+
+  std::map<std::type_index, StatisticsRegistry::TypeEntry>::iterator by_type =
+    registry.classes_by_type.find(std::type_index(type));
+  if (by_type != registry.classes_by_type.end() &&
+    by_type->second.library_path != statistics.library_path)
+  {
+    // The type_info of another version of the library compares equal, but the key has to belong
+    // to the library the entry is erased with
+    registry.classes_by_type.erase(by_type);
+    by_type = registry.classes_by_type.end();
+  }
+  if (by_type == registry.classes_by_type.end()) {
+    registry.classes_by_type.insert(
+      std::make_pair(
+        std::type_index(type),
+        StatisticsRegistry::TypeEntry{&statistics, statistics.library_path}));
+  } else {
+    by_type->second.statistics = &statistics;
+  }
+}
+
+void recordInstanceDestroyed(const std::type_info & type)
+{
+  StatisticsRegistry & registry = getStatisticsRegistry();
+  boost::mutex::scoped_lock lock(registry.mutex);
+  std::map<std::type_index, StatisticsRegistry::TypeEntry>::iterator itr =
+    registry.classes_by_type.find(std::type_index(type));
+  // Instances created while statistics were disabled are not known
+  if (itr != registry.classes_by_type.end() && itr->second.statistics->live_instances > 0) {
+    --itr->second.statistics->live_instances;
+  }
+}
+
+}  // namespace impl
+}  // namespace class_loader
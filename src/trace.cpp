@@ -0,0 +1,249 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "class_loader/trace.hpp"
+
+#include <boost/thread/mutex.hpp>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "class_loader/logging.hpp"
+
+namespace class_loader
+{
+namespace impl
+{
+
+typedef std::pair<std::string, std::string> TracedClassKey;  // (typeid(Base).name(), class name)
+
+struct TraceSink
+{
+  TraceSink();
+  ~TraceSink();
+
+  // Note: The caller must hold the mutex
+  void open(const std::string & trace_file);
+  void close();
+
+  boost::mutex mutex;
+  std::ofstream file;
+  bool empty;
+  // Classes an instance has been traced for
+  std::set<TracedClassKey> traced_classes;
+};
+
+static std::atomic<bool> & getTraceEnabledFlag()
+{
+  static std::atomic<bool> enabled(false);
+  return enabled;
+}
+
+static TraceSink & getTraceSink()
+{
+  static TraceSink sink;
+  return sink;
+}
+
+/**
+ * Timestamps are relative to the first use of the trace sink, the Chrome trace viewer only needs
+ * them to be monotonic.
+ */
+static std::chrono::steady_clock::time_point getTraceEpoch()
+{
+  static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  return epoch;
+}
+
+static unsigned int getTraceThreadId()
+{
+  static std::atomic<unsigned int> thread_count(0);
+  static thread_local unsigned int thread_id = ++thread_count;
+  return thread_id;
+}
+
+static int getTraceProcessId()
+{
+#ifndef _WIN32
+  return static_cast<int>(getpid());
+#else
+  return _getpid();
+#endif
+}
+
+static void appendJsonString(std::string & json, const char * value)
+{
+  json += '"';
+  for (const char * c = value; nullptr != c && '\0' != *c; ++c) {
+    if ('"' == *c || '\\' == *c) {
+      json += '\\';
+      json += *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(*c));
+      json += escaped;
+    } else {
+      json += *c;
+    }
+  }
+  json += '"';
+}
+
+static double toTraceMicroseconds(std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+TraceSink::TraceSink()
+: empty(true)
+{
+  getTraceEpoch();
+  const char * trace_file = getenv("CLASS_LOADER_TRACE_FILE");
+  if (nullptr != trace_file && '\0' != *trace_file) {
+    open(trace_file);
+  }
+}
+
+TraceSink::~TraceSink()
+{
+  boost::mutex::scoped_lock lock(mutex);
+  close();
+}
+
+void TraceSink::open(const std::string & trace_file)
+{
+  close();
+  file.open(trace_file.c_str(), std::ios::out | std::ios::trunc);
+  if (!file) {
+    CONSOLE_BRIDGE_logError(
+      "class_loader.impl: Could not open trace file %s, tracing is disabled.", trace_file.c_str());
+    return;
+  }
+  file << "[";
+  empty = true;
+  traced_classes.clear();
+  getTraceEnabledFlag().store(true, std::memory_order_relaxed);
+}
+
+void TraceSink::close()
+{
+  getTraceEnabledFlag().store(false, std::memory_order_relaxed);
+  if (file.is_open()) {
+    file << "\n]\n";
+    file.close();
+  }
+}
+
+bool setTraceFile(const std::string & trace_file)
+{
+  TraceSink & sink = getTraceSink();
+  boost::mutex::scoped_lock lock(sink.mutex);
+  if (trace_file.empty()) {
+    sink.close();
+    return true;
+  }
+  sink.open(trace_file);
+  return sink.file.is_open();
+}
+
+bool isTraceEnabled()
+{
+  // Constructing the sink opens the trace file named by the environment, if any
+  static TraceSink & sink = getTraceSink();
+  (void)sink;
+  return getTraceEnabledFlag().load(std::memory_order_relaxed);
+}
+
+void flushTrace()
+{
+  TraceSink & sink = getTraceSink();
+  boost::mutex::scoped_lock lock(sink.mutex);
+  if (sink.file.is_open()) {
+    sink.file.flush();
+  }
+}
+
+void recordTraceEvent(
+  const char * name, const char * detail, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end)
+{
+  // Format the event before taking the lock, events of distinct threads do not wait on each other
+  char numbers[128];
+  snprintf(
+    numbers, sizeof(numbers), "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,",
+    toTraceMicroseconds(start - getTraceEpoch()), toTraceMicroseconds(end - start),
+    getTraceProcessId(), getTraceThreadId());
+  std::string event = "{\"name\":";
+  appendJsonString(event, name);
+  event += ",\"cat\":\"class_loader\",";
+  event += numbers;
+  event += "\"args\":{\"detail\":";
+  appendJsonString(event, detail);
+  event += "}}";
+
+  TraceSink & sink = getTraceSink();
+  boost::mutex::scoped_lock lock(sink.mutex);
+  if (!sink.file.is_open()) {
+    return;
+  }
+  sink.file << (sink.empty ? "\n" : ",\n") << event;
+  sink.empty = false;
+}
+
+void recordInstanceTraced(
+  AbstractMetaObjectBase * factory, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end)
+{
+  TracedClassKey key(factory->typeidBaseClassName(), factory->className());
+  {
+    TraceSink & sink = getTraceSink();
+    boost::mutex::scoped_lock lock(sink.mutex);
+    if (!sink.traced_classes.insert(key).second) {
+      return;
+    }
+  }
+  recordTraceEvent("createInstance", key.second.c_str(), start, end);
+}
+
+}  // namespace impl
+}  // namespace class_loader
@@ -0,0 +1,184 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ * Copyright (c) 2018, Open Source Robotics Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Benchmarks of the load, lookup and instantiation paths. Besides the test plugins they use the
+// synthetic libraries generated from benchmark_plugins.cpp.in, see CMakeLists.txt.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "class_loader/class_loader.hpp"
+#include "class_loader/multi_library_class_loader.hpp"
+
+#include "Poco/SharedLibrary.h"
+
+#include "./base.hpp"
+
+const std::string LIBRARY_1 = class_loader::systemLibraryFormat("class_loader_TestPlugins1");  // NOLINT
+
+std::string getBenchmarkPluginsLibrary(int64_t num_classes)
+{
+  return class_loader::systemLibraryFormat(
+    "class_loader_BenchmarkPlugins" + std::to_string(num_classes));
+}
+
+std::string getBenchmarkRouteLibrary(int64_t library_index)
+{
+  return class_loader::systemLibraryFormat(
+    "class_loader_BenchmarkRoute" + std::to_string(library_index));
+}
+
+class_loader::ClassLoader & getSharedLoader()
+{
+  static class_loader::ClassLoader loader(LIBRARY_1, false);
+  return loader;
+}
+
+static void BM_LoadUnload(benchmark::State & state)
+{
+  const std::string library_path = getBenchmarkPluginsLibrary(state.range(0));
+  for (auto _ : state) {
+    class_loader::ClassLoader loader(library_path, false);
+    benchmark::DoNotOptimize(&loader);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LoadUnload)->Arg(10)->Arg(100)->Arg(1000);
+
+// Keeping the library open outside of class_loader leaves it in memory when it is unloaded, so
+// loading it again revives its factories from the graveyard rather than registering new ones.
+static void BM_GraveyardRevival(benchmark::State & state)
+{
+  const std::string library_path = getBenchmarkPluginsLibrary(state.range(0));
+  Poco::SharedLibrary * resident = nullptr;
+  {
+    class_loader::ClassLoader loader(library_path, false);
+    resident = new Poco::SharedLibrary(library_path);
+  }
+  for (auto _ : state) {
+    class_loader::ClassLoader loader(library_path, false);
+    benchmark::DoNotOptimize(&loader);
+  }
+  state.SetItemsProcessed(state.iterations());
+  delete resident;
+}
+BENCHMARK(BM_GraveyardRevival)->Arg(10)->Arg(100)->Arg(1000);
+
+// Every thread creates instances through the same ClassLoader, which stresses the lock
+// protecting the global plugin registry.
+static void BM_CreateInstanceContended(benchmark::State & state)
+{
+  class_loader::ClassLoader & loader = getSharedLoader();
+  for (auto _ : state) {
+    class_loader::ClassLoader::UniquePtr<Base> obj = loader.createUniqueInstance<Base>("Cat");
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreateInstanceContended)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_CreateSharedInstanceContended(benchmark::State & state)
+{
+  class_loader::ClassLoader & loader = getSharedLoader();
+  for (auto _ : state) {
+    std::shared_ptr<Base> obj = loader.createSharedInstance<Base>("Cat");
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreateSharedInstanceContended)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_CreatePooledInstanceContended(benchmark::State & state)
+{
+  class_loader::ClassLoader & loader = getSharedLoader();
+  for (auto _ : state) {
+    class_loader::ClassLoader::UniquePtr<Base> obj = loader.createPooledInstance<Base>("Cat");
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreatePooledInstanceContended)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_CreateInstanceFromFactory(benchmark::State & state)
+{
+  class_loader::ClassLoader::Factory<Base> factory =
+    getSharedLoader().getFactory<Base>("Cat");
+  for (auto _ : state) {
+    class_loader::ClassLoader::UniquePtr<Base> obj = factory.create();
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreateInstanceFromFactory)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_GetAvailableClasses(benchmark::State & state)
+{
+  class_loader::ClassLoader loader(getBenchmarkPluginsLibrary(state.range(0)), false);
+  for (auto _ : state) {
+    std::vector<std::string> classes = loader.getAvailableClasses<Base>();
+    benchmark::DoNotOptimize(classes.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetAvailableClasses)->Arg(10)->Arg(100)->Arg(1000);
+
+static void BM_GetAvailableClassesContended(benchmark::State & state)
+{
+  class_loader::ClassLoader & loader = getSharedLoader();
+  for (auto _ : state) {
+    std::vector<std::string> classes = loader.getAvailableClasses<Base>();
+    benchmark::DoNotOptimize(classes.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetAvailableClassesContended)->ThreadRange(1, 32)->UseRealTime();
+
+// Creates an instance of a class exported by the last of N libraries bound to the same
+// MultiLibraryClassLoader.
+static void BM_MultiLibraryRouting(benchmark::State & state)
+{
+  class_loader::MultiLibraryClassLoader loader(false);
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    loader.loadLibrary(getBenchmarkRouteLibrary(i));
+  }
+  const std::string class_name = "Route" + std::to_string(state.range(0) - 1) + "_9";
+  for (auto _ : state) {
+    class_loader::ClassLoader::UniquePtr<Base> obj =
+      loader.createUniqueInstance<Base>(class_name);
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MultiLibraryRouting)->Arg(1)->Arg(4)->Arg(16);
+
+BENCHMARK_MAIN();
@@ -63,8 +63,16 @@ public:
   virtual void saySomething() {std::cout << "Baaah" << std::endl;}
 };
 
+// Deriving virtually places the Base subobject at an offset that only the complete type knows
+class Mule : public virtual Base
+{
+public:
+  virtual void saySomething() {std::cout << "Hee-haw" << std::endl;}
+};
+
 CLASS_LOADER_REGISTER_CLASS(Dog, Base)
 CLASS_LOADER_REGISTER_CLASS(Cat, Base)
 CLASS_LOADER_REGISTER_CLASS(Duck, Base)
 CLASS_LOADER_REGISTER_CLASS(Cow, Base)
 CLASS_LOADER_REGISTER_CLASS(Sheep, Base)
+CLASS_LOADER_REGISTER_CLASS(Mule, Base)
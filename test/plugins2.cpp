@@ -27,7 +27,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstddef>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "class_loader/class_loader.hpp"
 
@@ -57,8 +60,32 @@ public:
   virtual void saySomething() {std::cout << "Brains!!!" << std::endl;}
 };
 
+class Android : public Base
+{
+public:
+  Android(std::string greeting, std::size_t repetitions)
+  : greeting_(greeting), repetitions_(repetitions)
+  {
+    if (0 == repetitions_) {
+      throw std::invalid_argument("An android has to say something");
+    }
+  }
+
+  virtual void saySomething()
+  {
+    for (std::size_t i = 0; i < repetitions_; ++i) {
+      std::cout << greeting_ << std::endl;
+    }
+  }
+
+private:
+  std::string greeting_;
+  std::size_t repetitions_;
+};
+
 
 CLASS_LOADER_REGISTER_CLASS(Robot, Base)
 CLASS_LOADER_REGISTER_CLASS(Alien, Base)
 CLASS_LOADER_REGISTER_CLASS(Monster, Base)
 CLASS_LOADER_REGISTER_CLASS(Zombie, Base)
+CLASS_LOADER_REGISTER_CLASS_WITH_ARGS(Android, Base, std::string, std::size_t)
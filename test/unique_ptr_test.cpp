@@ -81,6 +81,26 @@ TEST(ClassLoaderUniquePtrTest, correctLazyLoadUnload) {
   }
 }
 
+TEST(ClassLoaderUniquePtrTest, denseStorage) {
+  // The deleter must not make handles much larger than the raw pointer
+  EXPECT_LE(sizeof(ClassLoader::UniquePtr<Base>), 2 * sizeof(void *));
+
+  try {
+    ClassLoader loader1(LIBRARY_1, true);
+    {
+      std::vector<ClassLoader::UniquePtr<Base>> objs;
+      for (int i = 0; i < 16; ++i) {
+        objs.push_back(loader1.createUniqueInstance<Base>("Cat"));
+        objs.push_back(loader1.createPooledInstance<Base>("Dog"));
+      }
+      ASSERT_TRUE(loader1.isLibraryLoaded());
+    }
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
 TEST(ClassLoaderUniquePtrTest, nonExistentPlugin) {
   ClassLoader loader1(LIBRARY_1, false);
 
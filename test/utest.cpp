@@ -27,15 +27,28 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "class_loader/class_loader.hpp"
+#include "class_loader/manifest_cache.hpp"
 #include "class_loader/multi_library_class_loader.hpp"
 
 #include "gtest/gtest.h"
@@ -44,6 +57,8 @@
 
 const std::string LIBRARY_1 = class_loader::systemLibraryFormat("class_loader_TestPlugins1");  // NOLINT
 const std::string LIBRARY_2 = class_loader::systemLibraryFormat("class_loader_TestPlugins2");  // NOLINT
+const std::string LIBRARY_3 = class_loader::systemLibraryFormat("class_loader_TestPlugins3");  // NOLINT
+const std::string LIBRARY_4 = class_loader::systemLibraryFormat("class_loader_TestPlugins4");  // NOLINT
 
 TEST(ClassLoaderTest, basicLoad) {
   try {
@@ -151,6 +166,665 @@ TEST(ClassLoaderTest, invalidBase) {
   }
 }
 
+TEST(ClassLoaderTest, factoryHandle) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    class_loader::ClassLoader::Factory<Base> factory = loader1.getFactory<Base>("Dog");
+    ASSERT_TRUE(factory.isValid());
+    ASSERT_EQ("Dog", factory.getClassName());
+    {
+      class_loader::ClassLoader::UniquePtr<Base> obj = factory.create();
+      obj->saySomething();
+    }
+
+    loader1.unloadLibrary();
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+    ASSERT_FALSE(factory.isValid());
+    EXPECT_THROW(factory.create(), class_loader::CreateClassException);
+    EXPECT_THROW(loader1.getFactory<Base>("Bear"), class_loader::CreateClassException);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, pooledInstance) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    void * first = nullptr;
+    {
+      class_loader::ClassLoader::UniquePtr<Base> dog = loader1.createPooledInstance<Base>("Dog");
+      dog->saySomething();
+      first = dog.get();
+    }
+    class_loader::ClassLoader::UniquePtr<Base> dog = loader1.createPooledInstance<Base>("Dog");
+    ASSERT_EQ(first, dog.get());
+    class_loader::ClassLoader::UniquePtr<Base> other = loader1.createPooledInstance<Base>("Dog");
+    ASSERT_NE(dog.get(), other.get());
+    EXPECT_THROW(
+      loader1.createPooledInstance<Base>("Unicorn"), class_loader::CreateClassException);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    loader1.createPooledInstance<Base>("Cat")->saySomething();
+    // The pool does not keep the library open in on-demand mode
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, pooledInstanceConcurrently) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(
+        std::thread([&loader1]() {
+          for (int j = 0; j < 1000; ++j) {
+            class_loader::ClassLoader::UniquePtr<Base> dog =
+            loader1.createPooledInstance<Base>("Dog");
+            class_loader::ClassLoader::UniquePtr<Base> cat =
+            loader1.createPooledInstance<Base>("Cat");
+          }
+        }));
+    }
+    for (auto & thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(0, loader1.getInstanceCount());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, onDemandConcurrently) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(
+        std::thread([&loader1]() {
+          // The last instance of one thread unloads the library while others create theirs
+          for (int j = 0; j < 1000; ++j) {
+            loader1.createUniqueInstance<Base>("Dog");
+            loader1.createPooledInstance<Base>("Cat");
+          }
+        }));
+    }
+    for (auto & thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(0, loader1.getInstanceCount());
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, placementInstance) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    class_loader::ClassLoader::Factory<Base> dog_factory = loader1.getFactory<Base>("Dog");
+    ASSERT_LT(0u, dog_factory.objectSize());
+    ASSERT_LT(0u, dog_factory.objectAlignment());
+
+    alignas(std::max_align_t) unsigned char arena[2][256];
+    ASSERT_LE(dog_factory.objectSize(), sizeof(arena[0]));
+    {
+      class_loader::ClassLoader::PlacedPtr<Base> dog =
+        dog_factory.createAt(arena[0], sizeof(arena[0]));
+      class_loader::ClassLoader::PlacedPtr<Base> cat =
+        loader1.createInstanceAt<Base>("Cat", arena[1], sizeof(arena[1]));
+      ASSERT_EQ(static_cast<void *>(arena[0]), static_cast<void *>(dog.get()));
+      ASSERT_EQ(static_cast<void *>(arena[1]), static_cast<void *>(cat.get()));
+      dog->saySomething();
+      cat->saySomething();
+      ASSERT_EQ(2, loader1.getInstanceCount());
+
+      EXPECT_THROW(
+        loader1.createInstanceAt<Base>("Cat", arena[1], 1), class_loader::CreateClassException);
+      EXPECT_THROW(
+        dog_factory.createAt(arena[0] + 1, sizeof(arena[0]) - 1),
+        class_loader::CreateClassException);
+      EXPECT_THROW(dog_factory.createAt(nullptr, 0), class_loader::CreateClassException);
+      ASSERT_EQ(2, loader1.getInstanceCount());
+    }
+    // Instances created in place hold plugin references like any other
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, virtualBaseInstance) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    void * first = nullptr;
+    {
+      class_loader::ClassLoader::UniquePtr<Base> mule = loader1.createPooledInstance<Base>("Mule");
+      mule->saySomething();
+      first = mule.get();
+    }
+    class_loader::ClassLoader::UniquePtr<Base> mule = loader1.createPooledInstance<Base>("Mule");
+    ASSERT_EQ(first, mule.get());
+    mule->saySomething();
+
+    alignas(std::max_align_t) unsigned char arena[256];
+    {
+      class_loader::ClassLoader::PlacedPtr<Base> placed =
+        loader1.createInstanceAt<Base>("Mule", arena, sizeof(arena));
+      placed->saySomething();
+      ASSERT_EQ(2, loader1.getInstanceCount());
+    }
+    ASSERT_EQ(1, loader1.getInstanceCount());
+    mule.reset();
+    ASSERT_EQ(0, loader1.getInstanceCount());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+struct PlainBase
+{
+  int kind = 0;
+};
+
+struct PlainDerived : public PlainBase
+{
+  PlainDerived() {kind = 1;}
+  ~PlainDerived() {++destroyed;}
+  static int destroyed;
+};
+int PlainDerived::destroyed = 0;
+
+TEST(ClassLoaderTest, nonPolymorphicBaseInstance) {
+  class_loader::impl::MetaObject<PlainDerived, PlainBase> factory("PlainDerived", "PlainBase");
+  alignas(std::max_align_t) unsigned char arena[64];
+  ASSERT_LE(factory.objectSize(), sizeof(arena));
+  PlainBase * obj = factory.createAt(arena);
+  ASSERT_EQ(1, obj->kind);
+  ASSERT_EQ(static_cast<void *>(arena), factory.destroyAt(obj));
+  ASSERT_EQ(1, PlainDerived::destroyed);
+}
+
+TEST(ClassLoaderTest, reloadLibrary) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    class_loader::ClassLoader::UniquePtr<Base> dog = loader1.createUniqueInstance<Base>("Dog");
+    loader1.reloadLibrary();
+    // The previous version stays mapped while its instances are alive
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+    ASSERT_TRUE(loader1.isClassAvailable<Base>("Dog"));
+    ASSERT_EQ(0, loader1.getInstanceCount());
+
+    bool transferred = false;
+    dog = loader1.migrateInstance<Base>(
+      "Dog", std::move(dog), [&transferred](Base &, Base &) {transferred = true;});
+    ASSERT_TRUE(transferred);
+    ASSERT_TRUE(dog != nullptr);
+    dog->saySomething();
+    ASSERT_EQ(1, loader1.getInstanceCount());
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+
+    loader1.reloadLibrary();
+    dog.reset();
+    loader1.createUniqueInstance<Base>("Cat")->saySomething();
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+}
+
+#ifndef _WIN32
+TEST(ClassLoaderTest, reloadLibraryFile) {
+  std::string version_path = class_loader::impl::createLibraryVersion(LIBRARY_1);
+  std::string version_directory = version_path.substr(0, version_path.find_last_of('/'));
+  ASSERT_NE(std::string::npos, version_directory.find("class_loader-"));
+  ASSERT_NE(0, access(version_path.c_str(), F_OK));
+  {
+    class_loader::ClassLoader version(version_path, true);
+    for (int i = 0; i < 2; ++i) {
+      // The copy is made again whenever the version is opened, and not left on disk
+      version.createUniqueInstance<Base>("Dog")->saySomething();
+      ASSERT_FALSE(version.isLibraryLoaded());
+      ASSERT_NE(0, access(version_path.c_str(), F_OK));
+    }
+  }
+  class_loader::impl::removeLibraryVersion(version_path);
+  ASSERT_NE(0, access(version_directory.c_str(), F_OK));
+}
+
+TEST(ClassLoaderTest, reloadChangedLibrary) {
+  char directory_template[] = "/tmp/class_loader_test-XXXXXX";
+  ASSERT_TRUE(nullptr != mkdtemp(directory_template));
+  std::string directory(directory_template);
+  std::string library_file = directory + "/" + LIBRARY_1;
+  // Installs a library like a package manager, the file in use is replaced rather than modified
+  auto install = [&library_file](const std::string & library_path) {
+      std::string staged = library_file + ".new";
+      {
+        std::ifstream source(class_loader::impl::findLibraryFile(library_path), std::ios::binary);
+        std::ofstream copy(staged, std::ios::binary);
+        copy << source.rdbuf();
+      }
+      return 0 == std::rename(staged.c_str(), library_file.c_str());
+    };
+  ASSERT_TRUE(install(LIBRARY_1));
+  try {
+    class_loader::ClassLoader loader1(library_file, false);
+    class_loader::ClassLoader::UniquePtr<Base> dog = loader1.createUniqueInstance<Base>("Dog");
+    ASSERT_FALSE(loader1.isClassAvailable<Base>("Robot"));
+
+    ASSERT_TRUE(install(LIBRARY_2));
+    loader1.reloadLibrary();
+    // New instances come from the installed file, existing ones from the file they were created by
+    ASSERT_FALSE(loader1.isClassAvailable<Base>("Dog"));
+    ASSERT_TRUE(loader1.isClassAvailable<Base>("Robot"));
+    loader1.createUniqueInstance<Base>("Robot")->saySomething();
+    dog->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    ADD_FAILURE() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  std::remove(library_file.c_str());
+  std::remove(directory.c_str());
+}
+#endif
+
+TEST(ClassLoaderTest, reloadLibraryScope) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    class_loader::ClassLoader loader2(LIBRARY_1, false);
+    class_loader::MultiLibraryClassLoader multi_loader(false);
+    multi_loader.loadLibrary(LIBRARY_1);
+    loader1.reloadLibrary();
+
+    // Only the loader that reloaded moves to the new version
+    ASSERT_EQ(loader1.getAvailableClasses<Base>(), loader2.getAvailableClasses<Base>());
+    ASSERT_TRUE(loader2.isClassAvailable<Base>("Dog"));
+    ASSERT_TRUE(multi_loader.isClassAvailable<Base>("Dog"));
+    loader2.createInstance<Base>("Dog")->saySomething();
+    multi_loader.createInstance<Base>("Cat")->saySomething();
+    loader1.createInstance<Base>("Duck")->saySomething();
+
+    // The previous version stays loaded as long as others use it
+    ASSERT_TRUE(loader2.isLibraryLoaded());
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    loader2.unloadLibrary();
+    multi_loader.unloadLibrary(LIBRARY_1);
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    loader1.createInstance<Base>("Cow")->saySomething();
+
+    // Loading the library again revives its factories next to the new version
+    loader2.loadLibrary();
+    loader2.createInstance<Base>("Sheep")->saySomething();
+    loader1.createInstance<Base>("Sheep")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+}
+
+TEST(ClassLoaderTest, bulkInstances) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    {
+      std::vector<class_loader::ClassLoader::UniquePtr<Base>> dogs =
+        loader1.createInstances<Base>("Dog", 3);
+      ASSERT_EQ(3u, dogs.size());
+      ASSERT_EQ(3, loader1.getInstanceCount());
+      ASSERT_NE(dogs[0].get(), dogs[1].get());
+      dogs[2]->saySomething();
+      dogs.pop_back();
+      ASSERT_TRUE(loader1.isLibraryLoaded());
+    }
+    ASSERT_EQ(0, loader1.getInstanceCount());
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+    ASSERT_TRUE(loader1.createInstances<Base>("Dog", 0).empty());
+    EXPECT_THROW(loader1.createInstances<Base>("Unicorn", 2), class_loader::CreateClassException);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+
+  try {
+    class_loader::MultiLibraryClassLoader loader(true);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    ASSERT_EQ(2u, loader.createInstances<Base>("Robot", 2).size());
+    ASSERT_EQ(2u, loader.createInstances<Base>("Cat", LIBRARY_1, 2).size());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, statistics) {
+  class_loader::impl::resetStatistics();
+  class_loader::impl::setStatisticsEnabled(true);
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_2, true);
+    {
+      boost::shared_ptr<Base> robot = loader1.createInstance<Base>("Robot");
+      class_loader::ClassLoader::UniquePtr<Base> alien =
+        loader1.createPooledInstance<Base>("Alien");
+
+      class_loader::impl::Statistics statistics = class_loader::impl::getStatistics();
+      ASSERT_TRUE(statistics.enabled);
+      ASSERT_EQ(2u, statistics.classes.size());
+      for (auto & class_statistics : statistics.classes) {
+        EXPECT_EQ(1u, class_statistics.create_count);
+        EXPECT_EQ(1u, class_statistics.live_instances);
+        EXPECT_EQ(LIBRARY_2, class_statistics.library_path);
+      }
+    }
+
+    class_loader::impl::Statistics statistics = class_loader::impl::getStatistics();
+    ASSERT_EQ(1u, statistics.libraries.size());
+    EXPECT_EQ(LIBRARY_2, statistics.libraries.front().library_path);
+    EXPECT_EQ(1u, statistics.libraries.front().load_count);
+    EXPECT_EQ(1u, statistics.libraries.front().unload_count);
+    for (auto & class_statistics : statistics.classes) {
+      EXPECT_EQ(0u, class_statistics.live_instances);
+    }
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  class_loader::impl::setStatisticsEnabled(false);
+  class_loader::impl::resetStatistics();
+}
+
+TEST(ClassLoaderTest, statisticsAcrossReload) {
+  class_loader::impl::resetStatistics();
+  class_loader::impl::setStatisticsEnabled(true);
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    class_loader::ClassLoader::UniquePtr<Base> dog = loader1.createUniqueInstance<Base>("Dog");
+    loader1.reloadLibrary();
+    class_loader::ClassLoader::UniquePtr<Base> new_dog =
+      loader1.createUniqueInstance<Base>("Dog");
+    // Closes the previous version, the types recorded for it must go with it
+    dog.reset();
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    loader1.createUniqueInstance<Base>("Dog")->saySomething();
+    new_dog.reset();
+
+    loader1.reloadLibrary();
+    loader1.createUniqueInstance<Base>("Dog")->saySomething();
+    loader1.unloadLibrary();
+    loader1.loadLibrary();
+    loader1.createUniqueInstance<Base>("Dog")->saySomething();
+
+    class_loader::impl::Statistics statistics = class_loader::impl::getStatistics();
+    for (auto & class_statistics : statistics.classes) {
+      EXPECT_EQ(5u, class_statistics.create_count);
+      EXPECT_EQ(0u, class_statistics.live_instances);
+    }
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  class_loader::impl::setStatisticsEnabled(false);
+  class_loader::impl::resetStatistics();
+}
+
+TEST(ClassLoaderTest, trace) {
+  const std::string trace_path = "class_loader_utest_trace.json";
+  ASSERT_TRUE(class_loader::impl::setTraceFile(trace_path));
+  ASSERT_TRUE(class_loader::impl::isTraceEnabled());
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_2, true);
+    loader1.createInstance<Base>("Robot")->saySomething();
+    loader1.createInstance<Base>("Robot")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  ASSERT_TRUE(class_loader::impl::setTraceFile(""));
+  ASSERT_FALSE(class_loader::impl::isTraceEnabled());
+
+  std::ifstream trace_file(trace_path);
+  std::string trace((std::istreambuf_iterator<char>(trace_file)), std::istreambuf_iterator<char>());
+  std::remove(trace_path.c_str());
+  ASSERT_EQ('[', trace.front());
+  ASSERT_EQ("]\n", trace.substr(trace.size() - 2));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"loadLibrary\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"dlopen\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"registerPlugin\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"unloadLibrary\""));
+  // Only the first instance of a class is traced
+  std::string::size_type create = trace.find("\"name\":\"createInstance\"");
+  ASSERT_NE(std::string::npos, create);
+  EXPECT_EQ(std::string::npos, trace.find("\"name\":\"createInstance\"", create + 1));
+}
+
+TEST(ClassLoaderTest, localLoadFlags) {
+  try {
+    {
+      class_loader::ClassLoader loader1(LIBRARY_1, false, class_loader::LIBRARY_LOAD_LOCAL);
+      ASSERT_EQ(
+        static_cast<unsigned int>(class_loader::LIBRARY_LOAD_LOCAL), loader1.getLoadFlags());
+      ASSERT_TRUE(loader1.isLibraryLoaded());
+      loader1.createInstance<Base>("Dog")->saySomething();
+    }
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+
+    class_loader::MultiLibraryClassLoader loader(false, class_loader::LIBRARY_LOAD_LOCAL);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    loader.createInstance<Base>("Cat")->saySomething();
+    loader.createInstance<Base>("Robot")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, factoryLookupCache) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    uint64_t generation = class_loader::impl::getRegistryGeneration();
+    for (int i = 0; i < 3; ++i) {
+      loader1.createUniqueInstance<Base>("Dog")->saySomething();
+      loader1.createUniqueInstance<Base>("Cat")->saySomething();
+    }
+    // Lookups leave the registry alone
+    ASSERT_EQ(generation, class_loader::impl::getRegistryGeneration());
+
+    // Lookups cached while the library was loaded must not outlive it
+    loader1.unloadLibrary();
+    ASSERT_LT(generation, class_loader::impl::getRegistryGeneration());
+    EXPECT_THROW(
+      delete class_loader::impl::createInstance<Base>("Dog", &loader1),
+      class_loader::CreateClassException);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, prefetch) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    std::shared_future<void> prefetch = loader1.prefetch();
+    {
+      // Either waits for the prefetch or finds the library already loaded
+      boost::shared_ptr<Base> dog = loader1.createInstance<Base>("Dog");
+      dog->saySomething();
+      ASSERT_TRUE(prefetch.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+      ASSERT_TRUE(loader1.isLibraryLoaded());
+    }
+    // The prefetch stands in for the load of the first instance
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+
+    class_loader::ClassLoader loader2("libDoesNotExist.so", true);
+    EXPECT_THROW(loader2.prefetch().get(), class_loader::LibraryLoadException);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+
+  try {
+    class_loader::MultiLibraryClassLoader loader(true);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    for (auto & prefetch : loader.prefetchLibraries({LIBRARY_2, "libDoesNotExist.so"})) {
+      prefetch.wait();
+    }
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    loader.createInstance<Base>("Robot")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, prefetchDependencies) {
+  ASSERT_TRUE(class_loader::impl::prefetchLibrary(LIBRARY_1, true));
+  ASSERT_FALSE(class_loader::impl::prefetchLibrary("libDoesNotExist.so", true));
+  try {
+    class_loader::ClassLoader loader1(
+      LIBRARY_1, true, class_loader::LIBRARY_PREFETCH_DEPENDENCIES);
+    loader1.prefetch().get();
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+    loader1.createInstance<Base>("Dog")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+bool waitForUnload(class_loader::ClassLoader & loader)
+{
+  for (int i = 0; i < 500 && loader.isLibraryLoaded(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return !loader.isLibraryLoaded();
+}
+
+TEST(ClassLoaderTest, delayedUnload) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    loader1.setUnloadDelay(std::chrono::milliseconds(100));
+    loader1.createInstance<Base>("Dog")->saySomething();
+    // Kept loaded for the next instance
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+    loader1.createInstance<Base>("Cat")->saySomething();
+    ASSERT_TRUE(waitForUnload(loader1));
+
+    // Exceeding the budget of idle libraries unloads them without waiting for the delay
+    loader1.setUnloadDelay(std::chrono::hours(1));
+    class_loader::ClassLoader::setMaxIdleLibraries(0);
+    loader1.createInstance<Base>("Dog")->saySomething();
+    ASSERT_TRUE(waitForUnload(loader1));
+    class_loader::ClassLoader::setMaxIdleLibraries(std::numeric_limits<std::size_t>::max());
+
+    // Destroying the loader cancels the pending unload
+    class_loader::ClassLoader loader2(LIBRARY_2, true);
+    loader2.setUnloadDelay(std::chrono::hours(1));
+    loader2.createInstance<Base>("Robot")->saySomething();
+    ASSERT_TRUE(loader2.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+}
+
+TEST(ClassLoaderTest, constructorArguments) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_2, true);
+    {
+      class_loader::ClassLoader::UniquePtr<Base> android =
+        loader1.createUniqueInstance<Base>("Android", std::string("Hello"), std::size_t(2));
+      android->saySomething();
+      ASSERT_TRUE(loader1.isClassAvailable<Base>("Android"));
+      const std::string greeting = "Goodbye";
+      loader1.createSharedInstance<Base>("Android", greeting, std::size_t(1))->saySomething();
+      ASSERT_EQ(1, loader1.getInstanceCount());
+    }
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+
+    // The arguments must match the registered constructor arguments
+    EXPECT_THROW(
+      loader1.createUniqueInstance<Base>("Android"), class_loader::CreateClassException);
+    EXPECT_THROW(
+      loader1.createUniqueInstance<Base>("Android", std::string("Hello")),
+      class_loader::CreateClassException);
+    EXPECT_THROW(
+      loader1.createUniqueInstance<Base>("Robot", std::string("Hello"), std::size_t(2)),
+      class_loader::CreateClassException);
+    EXPECT_EQ(0, loader1.getInstanceCount());
+
+    // A throwing constructor gives its plugin reference back
+    EXPECT_THROW(
+      loader1.createUniqueInstance<Base>("Android", std::string("Hello"), std::size_t(0)),
+      std::invalid_argument);
+    EXPECT_EQ(0, loader1.getInstanceCount());
+    ASSERT_FALSE(loader1.isLibraryLoaded());
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, classTable) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_3, false);
+    std::vector<std::string> classes = loader1.getAvailableClasses<Base>();
+    ASSERT_EQ(2u, classes.size());
+    ASSERT_TRUE(loader1.isClassAvailable<Base>("Parrot"));
+    loader1.createInstance<Base>("Goldfish")->saySomething();
+
+    class_loader::ClassLoader loader2(LIBRARY_3, false);
+    loader2.createInstance<Base>("Parrot")->saySomething();
+    loader1.unloadLibrary();
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+    loader2.unloadLibrary();
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+
+    // Reloading registers the table again
+    loader1.loadLibrary();
+    loader1.createInstance<Base>("Parrot")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, classTableOfDependency) {
+  try {
+    // Loads the library with the class table as a dependency
+    class_loader::ClassLoader loader1(LIBRARY_4, false);
+    std::vector<std::string> classes = loader1.getAvailableClasses<Base>();
+    ASSERT_EQ(1u, classes.size());
+    ASSERT_EQ("Parakeet", classes[0]);
+    ASSERT_FALSE(loader1.isClassAvailable<Base>("Parrot"));
+    loader1.createInstance<Base>("Parakeet")->saySomething();
+
+    class_loader::ClassLoader loader2(LIBRARY_3, false);
+    ASSERT_EQ(2u, loader2.getAvailableClasses<Base>().size());
+    loader2.createInstance<Base>("Parrot")->saySomething();
+    ASSERT_FALSE(loader1.isClassAvailable<Base>("Parrot"));
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, sharedLibraryOwnership) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    class_loader::ClassLoader loader2(LIBRARY_1, false);
+    std::vector<std::string> libs = class_loader::impl::getAllLibrariesUsedByClassLoader(&loader1);
+    ASSERT_EQ(1u, libs.size());
+    ASSERT_EQ(LIBRARY_1, libs.front());
+
+    loader1.unloadLibrary();
+    ASSERT_TRUE(class_loader::impl::getAllLibrariesUsedByClassLoader(&loader1).empty());
+    ASSERT_EQ(1u, class_loader::impl::getAllLibrariesUsedByClassLoader(&loader2).size());
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    loader2.createInstance<Base>("Cat")->saySomething();
+
+    loader2.unloadLibrary();
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
 void wait(int seconds)
 {
   std::this_thread::sleep_for(std::chrono::seconds(seconds));
@@ -195,6 +869,23 @@ TEST(ClassLoaderTest, threadSafety) {
   }
 }
 
+TEST(ClassLoaderTest, concurrentLoadAttribution) {
+  for (int i = 0; i < 20; ++i) {
+    class_loader::ClassLoader loader1(LIBRARY_1, true);
+    class_loader::ClassLoader loader2(LIBRARY_2, true);
+    std::thread thread1([&loader1]() {loader1.loadLibrary();});
+    std::thread thread2([&loader2]() {loader2.loadLibrary();});
+    thread1.join();
+    thread2.join();
+
+    ASSERT_TRUE(loader1.isClassAvailable<Base>("Cat"));
+    ASSERT_FALSE(loader1.isClassAvailable<Base>("Robot"));
+    ASSERT_TRUE(loader2.isClassAvailable<Base>("Robot"));
+    ASSERT_FALSE(loader2.isClassAvailable<Base>("Cat"));
+    ASSERT_FALSE(class_loader::impl::hasANonPurePluginLibraryBeenOpened());
+  }
+}
+
 TEST(ClassLoaderTest, loadRefCountingNonLazy) {
   try {
     class_loader::ClassLoader loader1(LIBRARY_1, false);
@@ -318,6 +1009,256 @@ TEST(MultiClassLoaderTest, noWarningOnLazyLoad) {
   SUCCEED();
 }
 
+TEST(MultiClassLoaderTest, loadLibraries) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(false);
+    std::vector<class_loader::LibraryLoadResult> results =
+      loader.loadLibraries({LIBRARY_1, "libDoesNotExist.so", LIBRARY_2, LIBRARY_1});
+    ASSERT_EQ(4u, results.size());
+    EXPECT_TRUE(results[0].success);
+    EXPECT_FALSE(results[1].success);
+    EXPECT_FALSE(results[1].error.empty());
+    EXPECT_TRUE(results[2].success);
+    EXPECT_TRUE(results[3].success);
+    EXPECT_EQ(2u, loader.getRegisteredLibraries().size());
+
+    loader.createInstance<Base>("Cat")->saySomething();
+    loader.createInstance<Base>("Robot")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(MultiClassLoaderTest, classIndex) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(true);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+    {
+      boost::shared_ptr<Base> robot = loader.createInstance<Base>("Robot");
+      robot->saySomething();
+      // Looking for Robot must not leave libraries open that do not export it
+      ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+      ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    }
+    loader.createInstance<Base>("Cat")->saySomething();
+
+    EXPECT_THROW(
+      loader.createInstance<Base>("Unicorn"), class_loader::CreateClassException);
+
+    loader.unloadLibrary(LIBRARY_2);
+    EXPECT_THROW(
+      loader.createInstance<Base>("Robot"), class_loader::CreateClassException);
+    loader.createInstance<Base>("Dog")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(MultiClassLoaderTest, forEachAvailableClass) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(false);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+
+    std::vector<std::string> visited;
+    loader.forEachAvailableClass<Base>(
+      [&visited](const std::string & class_name) {visited.push_back(class_name);});
+    std::vector<std::string> classes = loader.getAvailableClasses<Base>();
+    std::sort(visited.begin(), visited.end());
+    std::sort(classes.begin(), classes.end());
+    ASSERT_EQ(classes, visited);
+
+    ASSERT_TRUE(loader.isClassAvailable<Base>("Robot"));
+    ASSERT_TRUE(loader.isClassAvailable<Base>("Cat"));
+    ASSERT_FALSE(loader.isClassAvailable<Base>("Unicorn"));
+    ASSERT_FALSE(loader.isClassAvailable<InvalidBase>("Cat"));
+
+    size_t count = 0;
+    loader.forEachAvailableClass<InvalidBase>([&count](const std::string &) {++count;});
+    ASSERT_EQ(0u, count);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(ClassLoaderTest, forEachAvailableClassWhileLoading) {
+  try {
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    std::atomic<bool> done(false);
+    // Loads keep taking the registry lock exclusively while the classes are visited
+    std::thread load_thread([&done]() {
+        while (!done) {
+          class_loader::ClassLoader loader2(LIBRARY_2, false);
+        }
+      });
+    size_t created = 0;
+    for (int i = 0; i < 100; ++i) {
+      loader1.forEachAvailableClass<Base>(
+        [&loader1, &created](const std::string & class_name) {
+          loader1.createUniqueInstance<Base>(class_name);
+          ++created;
+        });
+    }
+    done = true;
+    load_thread.join();
+    ASSERT_EQ(100 * loader1.getAvailableClasses<Base>().size(), created);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(MultiClassLoaderTest, manifestCache) {
+  const std::string cache_path = "class_loader_utest_manifest_cache";
+  std::remove(cache_path.c_str());
+  class_loader::impl::setManifestCachePath(cache_path);
+  try {
+    {
+      class_loader::MultiLibraryClassLoader loader(false);
+      loader.loadLibrary(LIBRARY_1);
+      // The cache file is written once the loader is done rather than for every library
+      ASSERT_FALSE(std::ifstream(cache_path.c_str()).good());
+    }
+    ASSERT_TRUE(std::ifstream(cache_path.c_str()).good());
+
+    // Forget what is in memory, as if this was a later process
+    class_loader::impl::setManifestCachePath(cache_path);
+    class_loader::MultiLibraryClassLoader loader(true);
+    loader.loadLibrary(LIBRARY_1);
+    ASSERT_TRUE(loader.isClassAvailable<Base>("Cat"));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+
+    loader.createInstance<Base>("Cat")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  class_loader::impl::setManifestCachePath("");
+  std::remove(cache_path.c_str());
+  std::remove((cache_path + ".lock").c_str());
+}
+
+TEST(MultiClassLoaderTest, residencyBudget) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(false);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    class_loader::ResidencyStatistics statistics = loader.getResidencyStatistics();
+    ASSERT_EQ(2u, statistics.resident_libraries);
+    ASSERT_EQ(0u, statistics.pinned_libraries);
+#ifdef __linux__
+    ASSERT_LT(0u, statistics.resident_size);
+#endif
+
+    // Nothing fits, so every library without instances is unloaded
+    loader.setResidencyBudget(1);
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    ASSERT_EQ(2u, loader.getResidencyStatistics().evictions);
+
+    {
+      boost::shared_ptr<Base> robot = loader.createInstance<Base>("Robot");
+      boost::shared_ptr<Base> cat = loader.createInstance<Base>("Cat");
+      // Libraries with live instances are kept
+      ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+      ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    }
+    loader.createInstance<Base>("Dog")->saySomething();
+    ASSERT_TRUE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    ASSERT_EQ(3u, loader.getResidencyStatistics().evictions);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(MultiClassLoaderTest, residencyBudgetConcurrently) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(false);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    // Every creation evicts the library used by the other threads if it is idle
+    loader.setResidencyBudget(1);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(
+        std::thread([&loader, i]() {
+          for (int j = 0; j < 200; ++j) {
+            loader.createUniqueInstance<Base>(0 == i % 2 ? "Dog" : "Robot")->saySomething();
+          }
+        }));
+    }
+    for (auto & thread : threads) {
+      thread.join();
+    }
+    ASSERT_LT(0u, loader.getResidencyStatistics().evictions);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+TEST(MultiClassLoaderTest, residencyBudgetOnDemandConcurrently) {
+  try {
+    class_loader::MultiLibraryClassLoader loader(true);
+    loader.loadLibrary(LIBRARY_1);
+    loader.loadLibrary(LIBRARY_2);
+    loader.setResidencyBudget(1);
+    // Evictions race with the last instances of the other threads unloading the same library
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.push_back(
+        std::thread([&loader, i]() {
+          for (int j = 0; j < 2000; ++j) {
+            loader.createUniqueInstance<Base>(0 == i % 2 ? "Dog" : "Robot")->saySomething();
+          }
+        }));
+    }
+    for (auto & thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(0u, loader.getResidencyStatistics().pinned_libraries);
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+}
+
+// Note: Keep this test last, the libraries it unloads in fast exit mode stay mapped
+TEST(MultiClassLoaderTest, fastExitShutdown) {
+  class_loader::impl::resetStatistics();
+  class_loader::impl::setStatisticsEnabled(true);
+  class_loader::impl::setFastExitEnabled(true);
+  try {
+    {
+      class_loader::MultiLibraryClassLoader loader(false);
+      loader.loadLibraries({LIBRARY_1, LIBRARY_2});
+      loader.createInstance<Base>("Robot")->saySomething();
+      loader.createInstance<Base>("Cat")->saySomething();
+    }
+    // The shutdown unbinds the libraries even though they are not closed
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+    ASSERT_FALSE(class_loader::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+    class_loader::impl::setFastExitEnabled(false);
+    class_loader::impl::setStatisticsEnabled(false);
+    class_loader::impl::Statistics statistics = class_loader::impl::getStatistics();
+    ASSERT_EQ(2u, statistics.libraries.size());
+    for (auto & library_statistics : statistics.libraries) {
+      EXPECT_EQ(1u, library_statistics.unload_count);
+    }
+
+    // The factories of libraries that stayed mapped are revived from the graveyard
+    class_loader::ClassLoader loader1(LIBRARY_1, false);
+    ASSERT_TRUE(loader1.isClassAvailable<Base>("Dog"));
+    loader1.createInstance<Base>("Dog")->saySomething();
+  } catch (class_loader::ClassLoaderException & e) {
+    FAIL() << "ClassLoaderException: " << e.what() << "\n";
+  }
+  class_loader::impl::setFastExitEnabled(false);
+  class_loader::impl::setStatisticsEnabled(false);
+  class_loader::impl::resetStatistics();
+}
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char ** argv)
 {